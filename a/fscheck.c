@@ -9,6 +9,9 @@
 #define T_DIR  1   // Directory
 #define T_FILE 2   // File
 #define T_DEV  3   // Special device
+#define T_EXTENT 5 // File mapped by extents
+#define T_DIRIDX 6 // Hash index of a directory
+#define T_SMALLFILE 4 // Small file, always inline
 
 int image;
 int numInodeBlocks;
@@ -19,7 +22,9 @@ int dataBitmapAddr;
 int beginDataBlocksAddr;
 struct superblock* sb;
 struct dinode** inodes;
-char dataBitmap[BSIZE];
+char* dataBitmap;
+int numBitmapBlocks;
+int *blockUsedMap;
 char currBlock[BSIZE];
 int *inodeHashMap;
 int *inodeHashMap2;
@@ -32,9 +37,8 @@ int *directoryHashMap;
 // this accesses the bitmap entry for block "blockAddr" and returns the value,
 // which will be 0 or 1 for unallocated and deallocated respectively. 
 int isAllocated(int blockAddr) {
-        int base = blockAddr % BPB;
-        int bitSelect = 1 << (base % 8);
-        int out = dataBitmap[base / 8] & bitSelect;
+        int bitSelect = 1 << (blockAddr % 8);
+        int out = dataBitmap[blockAddr / 8] & bitSelect;
         return !(out == 0);   
 }
 
@@ -52,6 +56,188 @@ void aquireBlock(int addr) {
     read(image, currBlock, BSIZE);
 }
 
+// extent-mapped files keep (start, len) runs in addrs[] instead of
+// block addresses, with more runs in the block at addrs[NADDRS-1].
+// this copies all the runs of inode into runs[] (which must hold
+// NEXTENT + NEXTENTIND) and returns how many there are.
+int getExtents(struct dinode* inode, struct extent* runs) {
+	struct extent ind[NEXTENTIND];
+	struct extent* e = (struct extent*) inode->addrs;
+	int i, n = 0;
+
+	for(i = 0; i < NEXTENT && e[i].len > 0; i++)
+		runs[n++] = e[i];
+	if(inode->addrs[NADDRS-1] != 0) {
+		lseek(image, inode->addrs[NADDRS-1] * BSIZE, SEEK_SET);
+		read(image, ind, BSIZE);
+		for(i = 0; i < NEXTENTIND && ind[i].len > 0; i++)
+			runs[n++] = ind[i];
+	}
+	return n;
+}
+
+// this returns 1 if extent-mapped inode uses block addr for data
+// or for its overflow block
+int extentUsesBlock(struct dinode* inode, int addr) {
+	struct extent runs[NEXTENT + NEXTENTIND];
+	int i, n;
+
+	if(inode->addrs[NADDRS-1] == addr)
+		return 1;
+	n = getExtents(inode, runs);
+	for(i = 0; i < n; i++) {
+		if(addr >= runs[i].start && addr < runs[i].start + runs[i].len)
+			return 1;
+	}
+	return 0;
+}
+
+// this calls check(addr) for each block used by extent-mapped inode,
+// the overflow block included
+void forEachExtentBlock(struct dinode* inode, void (*check)(int)) {
+	struct extent runs[NEXTENT + NEXTENTIND];
+	int i, n, addr;
+
+	if(inode->addrs[NADDRS-1] != 0)
+		check(inode->addrs[NADDRS-1]);
+	n = getExtents(inode, runs);
+	for(i = 0; i < n; i++) {
+		for(addr = runs[i].start; addr < runs[i].start + runs[i].len; addr++)
+			check(addr);
+	}
+}
+
+// this calls check(addr) for each block below indirect block addr,
+// which sits depth levels above the data blocks, and for addr itself.
+// check is called on a block before it is read, so a check that exits
+// on a bad address keeps us from following it.
+void forEachIndirectBlock(int addr, int depth, void (*check)(int)) {
+	uint a[NINDIRECT];
+	int i;
+
+	check(addr);
+	lseek(image, addr * BSIZE, SEEK_SET);
+	read(image, a, BSIZE);
+	for(i = 0; i < NINDIRECT; i++) {
+		if(a[i] == 0)
+			continue;
+		if(depth > 1)
+			forEachIndirectBlock(a[i], depth - 1, check);
+		else
+			check(a[i]);
+	}
+}
+
+// this returns 1 if inode keeps its bytes in addrs[] rather than in
+// data blocks: a T_SMALLFILE, or a file or directory marked DI_INLINE
+int isInline(struct dinode* inode) {
+	if(inode->type == T_SMALLFILE)
+		return 1;
+	return (inode->type == T_FILE || inode->type == T_DIR) && (inode->flags & DI_INLINE);
+}
+
+// this calls check(addr) for each block used by inode: its data blocks
+// and the indirect blocks (or extent overflow block) that map them
+void forEachFileBlock(struct dinode* inode, void (*check)(int)) {
+	int i;
+
+	if(isInline(inode))
+		return;
+	if(inode->type == T_EXTENT) {
+		forEachExtentBlock(inode, check);
+		return;
+	}
+	for(i = 0; i < NDIRECT; i++) {
+		if(inode->addrs[i] != 0)
+			check(inode->addrs[i]);
+	}
+	for(i = 0; i < 3; i++) {
+		if(inode->addrs[NDIRECT + i] != 0)
+			forEachIndirectBlock(inode->addrs[NDIRECT + i], i + 1, check);
+	}
+}
+
+// this returns the disk block holding block bn of inode's data,
+// or 0 if there is none
+int fileBlock(struct dinode* inode, int bn) {
+	struct extent runs[NEXTENT + NEXTENTIND];
+	uint a[NINDIRECT];
+	int i, n, depth, span, addr;
+
+	if(isInline(inode))
+		return 0;
+	if(inode->type == T_EXTENT) {
+		n = getExtents(inode, runs);
+		for(i = 0; i < n; i++) {
+			if(bn < runs[i].len)
+				return runs[i].start + bn;
+			bn -= runs[i].len;
+		}
+		return 0;
+	}
+	if(bn < NDIRECT)
+		return inode->addrs[bn];
+	bn -= NDIRECT;
+	for(depth = 1, span = NINDIRECT; depth <= 3 && bn >= span; depth++, span *= NINDIRECT)
+		bn -= span;
+	if(depth > 3)
+		return 0;
+	addr = inode->addrs[NDIRECT + depth - 1];
+	for(span /= NINDIRECT; addr != 0; span /= NINDIRECT) {
+		lseek(image, addr * BSIZE, SEEK_SET);
+		read(image, a, BSIZE);
+		addr = a[bn / span];
+		if(span == 1)
+			break;
+		bn %= span;
+	}
+	return addr;
+}
+
+// this reads the dirent at byte offset off of directory inode into dir
+// and returns 0, or returns -1 if the block is missing
+int readDirent(struct dinode* inode, int off, struct dirent* dir) {
+	int addr;
+
+	if(isInline(inode)) {
+		if(off + sizeof(struct dirent) > SMALLFILE_SIZE)
+			return -1;
+		memcpy(dir, (char*) inode->addrs + off, sizeof(struct dirent));
+		return 0;
+	}
+	addr = fileBlock(inode, off / BSIZE);
+	if(addr == 0)
+		return -1;
+	lseek(image, addr * BSIZE + off % BSIZE, SEEK_SET);
+	read(image, dir, sizeof(struct dirent));
+	return 0;
+}
+
+// this reads the dirent totalRead bytes into block blockIndex of
+// directory inode into dir. an inline directory has no blocks: its
+// entries are read from addrs[] instead, and are empty past its size.
+void readDirBlock(struct dinode* inode, int blockIndex, int totalRead, struct dirent* dir) {
+	if(isInline(inode)) {
+		memset(dir, 0, sizeof(struct dirent));
+		if(totalRead + sizeof(struct dirent) <= inode->size)
+			memcpy(dir, (char*) inode->addrs + totalRead, sizeof(struct dirent));
+		return;
+	}
+	lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
+	read(image, dir, sizeof(struct dirent));
+}
+
+// this must match the kernel's dirhash (FNV-1a)
+uint dirhash(char* name) {
+	uint h = 2166136261;
+	int i;
+	for(i = 0; i < DIRSIZ && name[i]; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 16777619;
+	}
+	return h;
+}
+
 ////////////////////////////
 //// file system checks //// 
 ////////////////////////////
@@ -65,10 +251,17 @@ void badInode() {
         if (!(inode->type == 0)) {
             if (!(inode->type == T_FILE || 
                   inode->type == T_DIR ||
-                  inode->type == T_DEV)) {
+                  inode->type == T_DEV ||
+                  inode->type == T_SMALLFILE ||
+                  inode->type == T_EXTENT ||
+                  inode->type == T_DIRIDX)) {
                 fprintf(stderr,"ERROR: bad inode.\n");
                 exit(1);                                
             }
+            if (isInline(inode) && inode->size > SMALLFILE_SIZE) {
+                fprintf(stderr,"ERROR: bad inode.\n");
+                exit(1);
+            }
         }
     }
 }
@@ -86,7 +279,7 @@ void parentDirectoryMismatch() {
             int parent = -1;
             
             for(i = 0; i < NDIRECT; i++) {
-		if(inode->addrs[i] == 0) {
+		if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 			continue;
 		}
 				
@@ -99,8 +292,7 @@ void parentDirectoryMismatch() {
 				break;
 			}	
 		
-			lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-			read(image, dir, sizeof(struct dirent));	
+			readDirBlock(inode, blockIndex, totalRead, dir);
 			totalRead += sizeof(struct dirent); 
 			
 			if(dir->name[0] == 0) {
@@ -140,7 +332,7 @@ void parentDirectoryMismatch() {
 	   }   
 	   
 	   for(i = 0; i < NDIRECT; i++) {
-		if(inode->addrs[i] == 0) {
+		if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 			continue;
 		}
 				
@@ -153,8 +345,7 @@ void parentDirectoryMismatch() {
 				break;
 			}	
 		
-			lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-			read(image, dir, sizeof(struct dirent));	
+			readDirBlock(inode, blockIndex, totalRead, dir);
 			totalRead += sizeof(struct dirent); 
 			
 			if(dir->name[0] == 0) {
@@ -182,55 +373,22 @@ void parentDirectoryMismatch() {
     }    
 }
 
-void bitmapMarksBlockInUseButItIsNotInUse() {
-
-    int i, j, y, addr;
-    for(y = beginDataBlocksAddr; y < numDataBlocks + beginDataBlocksAddr; y++) {	
-    //for(i = beginDataBlocksAddr; i < BSIZE * numDataBlocks + 2 * BSIZE; i += BSIZE) {	
-    
-        int found = 0;        
-        if (isAllocated(y)) {
-		struct dinode* inode;
-
-		for(i = 0; i < numInodes; i++) {	
-			inode = getInode(i);
-
-			// check direct blocks
-			for(j = 0; j < NDIRECT; j++) {	
-				addr = inode->addrs[j];
-				if(addr == 0)
-					continue;
+void markBlockUsed(int addr) {
+	blockUsedMap[addr] = 1;
+}
 
-				if(addr == y) {
-					found = 1;
-					goto wasfound;
-				}
-			}  
+void bitmapMarksBlockInUseButItIsNotInUse() {
+	int i, y;
 
-			// check indirect blocks
-			addr = inode->addrs[NDIRECT];
-			if(addr == 0)
-				continue;
+	for(i = 0; i < numInodes; i++)
+		forEachFileBlock(getInode(i), markBlockUsed);
 
-			int numBlocksForFile = (inode->size) / BSIZE;
-			int indirectBase = addr;
-			int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;	
-			if( ((inode->size) % BSIZE) != 0)
-        			indirectEnd++;
-					
-			if(y >= indirectBase && y <= indirectEnd) {
-				found = 1;
-			}
+	for(y = beginDataBlocksAddr; y < numDataBlocks + beginDataBlocksAddr; y++) {	
+		if (isAllocated(y) && !blockUsedMap[y]) {
+			fprintf(stderr,"ERROR: bitmap marks block in use but it is not in use.\n");
+			exit(1);
 		}
-            
-            wasfound:
-            if (found == 0) {
-                fprintf(stderr,"ERROR: bitmap marks block in use but it is not in use.\n");
-                exit(1);
-            }
-        }
-    }
-
+	}
 }
 
 void inodeMarkedUseButNotFoundInADirectory(int inodeNumber, int level) {
@@ -244,7 +402,7 @@ void inodeMarkedUseButNotFoundInADirectory(int inodeNumber, int level) {
 		
 		// direct blocks
 		for(i = 0; i < NDIRECT; i++) {
-			if(inode->addrs[i] == 0) {
+			if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 				continue;
 			}
 				
@@ -257,8 +415,7 @@ void inodeMarkedUseButNotFoundInADirectory(int inodeNumber, int level) {
 					break;
 				}	
 		
-				lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-				read(image, dir, sizeof(struct dirent));	
+				readDirBlock(inode, blockIndex, totalRead, dir);
 				totalRead += sizeof(struct dirent); 
 			
 				if(dir->name[0] == 0) {
@@ -272,7 +429,7 @@ void inodeMarkedUseButNotFoundInADirectory(int inodeNumber, int level) {
 	
 		// indirect blocks
 		blockIndex = inode->addrs[NDIRECT];
-		if(blockIndex != 0) {
+		if(blockIndex != 0 && !isInline(inode)) {
 			int numBlocksForFile = (inode->size) / BSIZE;
 			int indirectBase = blockIndex;
 			int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
@@ -287,8 +444,7 @@ void inodeMarkedUseButNotFoundInADirectory(int inodeNumber, int level) {
 						break;
 					}	
 			
-					lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-					read(image, dir, sizeof(struct dirent));	
+					readDirBlock(inode, blockIndex, totalRead, dir);
 					totalRead += sizeof(struct dirent); 
 				
 					if(dir->name[0] == 0) {
@@ -304,7 +460,7 @@ void inodeMarkedUseButNotFoundInADirectory(int inodeNumber, int level) {
 
 	for(i = 0; i < numInodes; i++) {
 	        struct dinode* inode = getInode(i);
-		if( !(inode->type == T_DIR || inode->type == T_FILE || inode->type == T_DEV) ) {
+		if( !(inode->type == T_DIR || inode->type == T_FILE || inode->type == T_DEV || inode->type == T_SMALLFILE || inode->type == T_EXTENT) ) {
 			continue;
 		}
 		if(inodeHashMap2[i] == 1) {
@@ -339,7 +495,7 @@ void badReferenceCountForFile() {
 		
 		// direct blocks
 		for(i = 0; i < NDIRECT; i++) {
-			if(inode->addrs[i] == 0) {
+			if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 				continue;
 			}
 				
@@ -352,8 +508,7 @@ void badReferenceCountForFile() {
 					break;
 				}	
 		
-				lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-				read(image, dir, sizeof(struct dirent));	
+				readDirBlock(inode, blockIndex, totalRead, dir);
 				totalRead += sizeof(struct dirent); 
 			
 				if(dir->name[0] == 0) {
@@ -362,7 +517,7 @@ void badReferenceCountForFile() {
 			
 				int dirInode = dir->inum;
 				struct dinode* subinode = getInode(dirInode);
-				if(subinode->type == T_FILE) {
+				if(subinode->type == T_FILE || subinode->type == T_SMALLFILE || subinode->type == T_EXTENT) {
 					numRefs[dirInode]++;
 				}
 			}
@@ -370,7 +525,7 @@ void badReferenceCountForFile() {
 	
 		// indirect blocks
 		blockIndex = inode->addrs[NDIRECT];
-		if(blockIndex != 0) {
+		if(blockIndex != 0 && !isInline(inode)) {
 			int numBlocksForFile = (inode->size) / BSIZE;
 			int indirectBase = blockIndex;
 			int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
@@ -385,8 +540,7 @@ void badReferenceCountForFile() {
 						break;
 					}	
 			
-					lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-					read(image, dir, sizeof(struct dirent));	
+					readDirBlock(inode, blockIndex, totalRead, dir);
 					totalRead += sizeof(struct dirent); 
 				
 					if(dir->name[0] == 0) {
@@ -395,7 +549,7 @@ void badReferenceCountForFile() {
 			
 					int dirInode = dir->inum;
 					struct dinode* subinode = getInode(dirInode);
-					if(subinode->type == T_FILE) {
+					if(subinode->type == T_FILE || subinode->type == T_SMALLFILE || subinode->type == T_EXTENT) {
 						numRefs[dirInode]++;
 					}
 				}
@@ -407,7 +561,7 @@ void badReferenceCountForFile() {
 
 		struct dinode* inode = getInode(i);
 
-		if (inode->type == T_FILE) {
+		if (inode->type == T_FILE || inode->type == T_SMALLFILE || inode->type == T_EXTENT) {
 		    if (numRefs[i] != inode->nlink) {
 			fprintf(stderr,"ERROR: bad reference count for file.\n");
 			exit(1);
@@ -416,134 +570,47 @@ void badReferenceCountForFile() {
 	}    
 }
 
+void checkAddressInRange(int addr) {
+	if(addr < beginDataBlocksAddr || addr >= beginDataBlocksAddr + numDataBlocks) {
+		fprintf(stderr,"ERROR: bad address in inode.\n");
+		exit(1);
+	}
+}
+
 void badAddressInInode() {
-	int i, j, addr;
-	struct dinode* inode;
-	
-	for(i = 0; i < numInodes; i++) {	
-	       	inode = getInode(i);
+	int i;
 	
-		// check direct blocks
-		for(j = 0; j < NDIRECT; j++) {	
-			addr = inode->addrs[j];
-		
-			if(addr == 0)
-				continue;
+	for(i = 0; i < numInodes; i++)
+		forEachFileBlock(getInode(i), checkAddressInRange);
+}
 
-			if(addr < beginDataBlocksAddr || addr >= imageSize) {
-				fprintf(stderr,"ERROR: bad address in inode.\n");
-				exit(1);
-			}
-        }  
-        	
-        // check indirect blocks
-		addr = inode->addrs[NDIRECT];
-		if(addr == 0)
-			continue;
-		
-		int numBlocksForFile = (inode->size) / BSIZE;
-		int indirectBase = addr;
-		int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
-		
-		if(((inode->size) % BSIZE) != 0)
-			indirectEnd++;
-		
-		if(indirectBase < beginDataBlocksAddr || indirectBase >= imageSize) {
-			fprintf(stderr,"ERROR: bad address in inode.\n");
-			exit(1);
-		}	
-		if(indirectEnd < beginDataBlocksAddr || indirectEnd >= imageSize) {
-			fprintf(stderr,"ERROR: bad address in inode.\n");
-			exit(1);
-		}
-		
-		for(j = indirectBase; j <= indirectEnd; j++) {
-			if(!isAllocated(j)) {
-				//printf("derp %d", j);
-				//fprintf(stderr,"ERROR: bad address in inode.\n");
-				//exit(1);			
-			}
-			
-		}
-		
-		//printf("ADDR %d %d %d %d\n", indirectBase, indirectEnd, isAllocated(indirectBase), isAllocated(indirectEnd));
+void checkAddressAllocated(int addr) {
+	if(!isAllocated(addr)) {
+		fprintf(stderr,"ERROR: address used by inode but marked free in bitmap.\n");
+		exit(1);
 	}
 }
 
 void addressUsedByInodeButMarkedFreeInBitmap() {
-	int i, j, k, addr;
-	struct dinode* inode;
-	
-	for(i = 0; i < numInodes; i++) {	
-	       	inode = getInode(i);
+	int i;
 	
-		// check direct blocks
-		for(j = 0; j < NDIRECT; j++) {	
-			addr = inode->addrs[j];
-			if(addr == 0)
-				continue;
+	for(i = 0; i < numInodes; i++)
+		forEachFileBlock(getInode(i), checkAddressAllocated);
+}
 
-			if(!isAllocated(addr)) {
-				fprintf(stderr,"ERROR: address used by inode but marked free in bitmap.\n");
-				exit(1);
-			}
-        }  
-        	
-        // check indirect blocks
-		addr = inode->addrs[NDIRECT];
-		if(addr == 0)
-			continue;
-		
-		int numBlocksForFile = (inode->size) / BSIZE;
-		int indirectBase = addr;
-		int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
-		
-		for(k = indirectBase; k <= indirectEnd; k++) {
-			if(!isAllocated(k)) {
-				fprintf(stderr,"ERROR: address used by inode but marked free in bitmap.\n");
-				exit(1);
-			}
-		}
+void checkAddressUsedOnce(int addr) {
+	if(inodeHashMap[addr] != 0) {
+		fprintf(stderr,"ERROR: address used more than once.\n");
+		exit(1);
 	}
+	inodeHashMap[addr] = 1;
 }
 
 void addressUsedMoreThanOnce() {
-	int i, j, k, addr;
-	struct dinode* inode;
-	
-	for(i = 0; i < numInodes; i++) {	
-	       	inode = getInode(i);
+	int i;
 	
-		// check direct blocks
-		for(j = 0; j < NDIRECT; j++) {	
-			addr = inode->addrs[j];
-			if(addr == 0)
-				continue;
-
-			if(inodeHashMap[addr] != 0) {
-				fprintf(stderr,"ERROR: address used more than once.\n");
-				exit(1);
-			}
-			inodeHashMap[addr] = 1;
-        }  
-        	
-        // check indirect blocks
-		addr = inode->addrs[NDIRECT];
-		if(addr == 0)
-			continue;
-		
-		int numBlocksForFile = (inode->size) / BSIZE;
-		int indirectBase = addr;
-		int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
-		
-		for(k = indirectBase; k <= indirectEnd; k++) {
-			if(inodeHashMap[k] != 0) {
-				fprintf(stderr,"ERROR: address used more than once.\n");
-				exit(1);
-			}
-			inodeHashMap[k] = 1;
-		}
-	}
+	for(i = 0; i < numInodes; i++)
+		forEachFileBlock(getInode(i), checkAddressUsedOnce);
 }
 
 void rootDirectoryDoesNotExist() {
@@ -561,10 +628,8 @@ void rootDirectoryDoesNotExist() {
 	int rootBlock = root->addrs[0];
     struct dirent* dir = malloc(sizeof(struct dirent));
 
-    lseek(image, BSIZE * rootBlock, SEEK_SET);
-	
 	// check that . points to correct location
-	read(image, dir, sizeof(struct dirent));	
+	readDirBlock(root, rootBlock, 0, dir);
 	if( !(dir->name[0] == '.' && dir->name[1] == '\0') ) {
 		//fprintf(stderr,"ERROR: root directory does not exist\n");
 		//exit(1);
@@ -577,7 +642,7 @@ void rootDirectoryDoesNotExist() {
 	}
 	
 	// check that .. points to correct location
-	read(image, dir, sizeof(struct dirent));	
+	readDirBlock(root, rootBlock, sizeof(struct dirent), dir);
 	if( !(dir->name[0] == '.' && dir->name[1] == '.' && dir->name[2] == '\0') ) {
 		//fprintf(stderr,"ERROR: root directory does not exist\n");
 		//exit(1);
@@ -601,7 +666,7 @@ void directoryNotProperlyFormatted(int inodeNumber, int level) {
 		
 	// direct blocks
 	for(i = 0; i < NDIRECT; i++) {
-		if(inode->addrs[i] == 0) {
+		if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 			continue;
 		}
 				
@@ -614,8 +679,7 @@ void directoryNotProperlyFormatted(int inodeNumber, int level) {
 				break;
 			}	
 		
-			lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-			read(image, dir, sizeof(struct dirent));	
+			readDirBlock(inode, blockIndex, totalRead, dir);
 			totalRead += sizeof(struct dirent); 
 			
 			if(dir->name[0] == 0) {
@@ -643,7 +707,7 @@ void directoryNotProperlyFormatted(int inodeNumber, int level) {
 	
 	// indirect blocks
 	blockIndex = inode->addrs[NDIRECT];
-	if(blockIndex != 0) {
+	if(blockIndex != 0 && !isInline(inode)) {
 		int numBlocksForFile = (inode->size) / BSIZE;
 		int indirectBase = blockIndex;
 		int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
@@ -656,8 +720,7 @@ void directoryNotProperlyFormatted(int inodeNumber, int level) {
 					break;
 				}	
 			
-				lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-				read(image, dir, sizeof(struct dirent));	
+				readDirBlock(inode, blockIndex, totalRead, dir);
 				totalRead += sizeof(struct dirent); 
 				
 				if(dir->name[0] == 0) {
@@ -699,7 +762,7 @@ void inodeReferredToInDirectoryButMarkedFree(int inodeNumber, int level) {
 		
 	// direct blocks
 	for(i = 0; i < NDIRECT; i++) {
-		if(inode->addrs[i] == 0) {
+		if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 			continue;
 		}
 				
@@ -712,8 +775,7 @@ void inodeReferredToInDirectoryButMarkedFree(int inodeNumber, int level) {
 				break;
 			}	
 		
-			lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-			read(image, dir, sizeof(struct dirent));	
+			readDirBlock(inode, blockIndex, totalRead, dir);
 			totalRead += sizeof(struct dirent); 
 			
 			if(dir->name[0] == 0) {
@@ -723,7 +785,7 @@ void inodeReferredToInDirectoryButMarkedFree(int inodeNumber, int level) {
 			int dirInode = dir->inum;
 			struct dinode* subinode = getInode(dirInode);
 			
-			if( !(subinode->type == T_DIR || subinode->type == T_FILE || subinode->type == T_DEV) ) {
+			if( !(subinode->type == T_DIR || subinode->type == T_FILE || subinode->type == T_DEV || subinode->type == T_SMALLFILE || subinode->type == T_EXTENT) ) {
 				fprintf(stderr,"ERROR: inode referred to in directory but marked free.\n");	
 				exit(1);
 			}
@@ -743,7 +805,7 @@ void inodeReferredToInDirectoryButMarkedFree(int inodeNumber, int level) {
 	
 	// indirect blocks
 	blockIndex = inode->addrs[NDIRECT];
-	if(blockIndex != 0) {
+	if(blockIndex != 0 && !isInline(inode)) {
 		int numBlocksForFile = (inode->size) / BSIZE;
 		int indirectBase = blockIndex;
 		int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
@@ -758,8 +820,7 @@ void inodeReferredToInDirectoryButMarkedFree(int inodeNumber, int level) {
 					break;
 				}	
 			
-				lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-				read(image, dir, sizeof(struct dirent));	
+				readDirBlock(inode, blockIndex, totalRead, dir);
 				totalRead += sizeof(struct dirent); 
 				
 				if(dir->name[0] == 0) {
@@ -769,7 +830,7 @@ void inodeReferredToInDirectoryButMarkedFree(int inodeNumber, int level) {
 				int dirInode = dir->inum;
 				struct dinode* subinode = getInode(dirInode);
 				
-				if( !(subinode->type == T_DIR || subinode->type == T_FILE || subinode->type == T_DEV) ) {
+				if( !(subinode->type == T_DIR || subinode->type == T_FILE || subinode->type == T_DEV || subinode->type == T_SMALLFILE || subinode->type == T_EXTENT) ) {
 					fprintf(stderr,"ERROR: inode referred to in directory but marked free.\n");	
 					exit(1);					
 				}	
@@ -904,7 +965,7 @@ void directoryAppearsMoreThanOnceInFileSystem(int inodeNumber, int level) {
 		
 		// direct blocks
 		for(i = 0; i < NDIRECT; i++) {
-			if(inode->addrs[i] == 0) {
+			if(inode->addrs[i] == 0 || (isInline(inode) && i > 0)) {
 				continue;
 			}
 				
@@ -917,8 +978,7 @@ void directoryAppearsMoreThanOnceInFileSystem(int inodeNumber, int level) {
 					break;
 				}	
 		
-				lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-				read(image, dir, sizeof(struct dirent));	
+				readDirBlock(inode, blockIndex, totalRead, dir);
 				totalRead += sizeof(struct dirent); 
 			
 				if(dir->name[0] == 0) {
@@ -951,7 +1011,7 @@ void directoryAppearsMoreThanOnceInFileSystem(int inodeNumber, int level) {
 	
 		// indirect blocks
 		blockIndex = inode->addrs[NDIRECT];
-		if(blockIndex != 0) {
+		if(blockIndex != 0 && !isInline(inode)) {
 			int numBlocksForFile = (inode->size) / BSIZE;
 			int indirectBase = blockIndex;
 			int indirectEnd = indirectBase + numBlocksForFile - NDIRECT;
@@ -966,8 +1026,7 @@ void directoryAppearsMoreThanOnceInFileSystem(int inodeNumber, int level) {
 						break;
 					}	
 			
-					lseek(image, BSIZE * blockIndex + totalRead, SEEK_SET);
-					read(image, dir, sizeof(struct dirent));	
+					readDirBlock(inode, blockIndex, totalRead, dir);
 					totalRead += sizeof(struct dirent); 
 				
 					if(dir->name[0] == 0) {
@@ -1004,6 +1063,167 @@ void directoryAppearsMoreThanOnceInFileSystem(int inodeNumber, int level) {
 	
 }
 
+// a hashed directory's index must list exactly its entries, each
+// where a lookup probing from the name's hash would find it, and
+// every index must belong to exactly one directory
+void directoryIndexMismatch() {
+	int i, j, ent, nlive, nused, home, nslot;
+	uint v;
+	uint* slots = malloc(sizeof(uint) * NDIRIDX);
+	int* seen;
+	int* owners = malloc(sizeof(int) * numInodes);
+	struct dinode* inode;
+	struct dinode* index;
+	struct dirent dir;
+
+	for(i = 0; i < numInodes; i++)
+		owners[i] = 0;
+
+	for(i = 0; i < numInodes; i++) {
+		inode = getInode(i);
+		if(inode->type != T_DIR || inode->dirindex == 0)
+			continue;
+		index = getInode(inode->dirindex);
+		if(index == NULL || index->type != T_DIRIDX || owners[inode->dirindex]++ > 0) {
+			fprintf(stderr,"ERROR: bad directory index.\n");
+			exit(1);
+		}
+
+		// a power of two slots, at least a block's worth
+		nslot = index->size / sizeof(uint);
+		if(nslot < BSIZE / sizeof(uint) || nslot > NDIRIDX || (nslot & (nslot - 1)) != 0 ||
+		   index->size % sizeof(uint) != 0) {
+			fprintf(stderr,"ERROR: bad directory index.\n");
+			exit(1);
+		}
+
+		for(j = 0; j < nslot; j += BSIZE / sizeof(uint)) {
+			int addr = fileBlock(index, j / (BSIZE / sizeof(uint)));
+			if(addr == 0) {
+				fprintf(stderr,"ERROR: bad directory index.\n");
+				exit(1);
+			}
+			lseek(image, addr * BSIZE, SEEK_SET);
+			read(image, &slots[j], BSIZE);
+		}
+
+		seen = malloc(sizeof(int) * (inode->size / sizeof(struct dirent) + 1));
+		for(j = 0; j <= inode->size / sizeof(struct dirent); j++)
+			seen[j] = 0;
+
+		nused = 0;
+		nlive = 0;
+		for(j = 0; j < nslot; j++) {
+			v = slots[j];
+			if(v == 0)
+				continue;
+			nused++;
+			if(v == DIRIDX_DEL)
+				continue;
+			nlive++;
+			ent = DIRIDX_ENT(v);
+			if(ent * sizeof(struct dirent) >= inode->size || seen[ent]++ > 0 ||
+			   readDirent(inode, ent * sizeof(struct dirent), &dir) < 0 ||
+			   dir.inum == 0 || DIRIDX_TAG(dirhash(dir.name)) != DIRIDX_TAG(v)) {
+				fprintf(stderr,"ERROR: bad directory index.\n");
+				exit(1);
+			}
+			// no empty slot may lie between the name's home and here
+			for(home = dirhash(dir.name) % nslot; home != j; home = (home + 1) % nslot) {
+				if(slots[home] == 0) {
+					fprintf(stderr,"ERROR: bad directory index.\n");
+					exit(1);
+				}
+			}
+		}
+		if(nused != index->minor || nused > DIRIDX_MAX(nslot)) {
+			fprintf(stderr,"ERROR: bad directory index.\n");
+			exit(1);
+		}
+
+		// and every entry must be in the index
+		for(j = 0; j < inode->size / sizeof(struct dirent); j++) {
+			if(readDirent(inode, j * sizeof(struct dirent), &dir) == 0 && dir.inum != 0)
+				nlive--;
+		}
+		if(nlive != 0) {
+			fprintf(stderr,"ERROR: bad directory index.\n");
+			exit(1);
+		}
+		free(seen);
+	}
+
+	for(i = 0; i < numInodes; i++) {
+		if(getInode(i)->type == T_DIRIDX && owners[i] != 1) {
+			fprintf(stderr,"ERROR: bad directory index.\n");
+			exit(1);
+		}
+	}
+	free(owners);
+	free(slots);
+}
+
+// the log sits after the data blocks, and the bitmap marks all of it in use.
+void logNotMarkedInUse() {
+	int i;
+
+	for(i = 0; i < sb->nlog; i++) {
+		if(!isAllocated(sb->logstart + i)) {
+			fprintf(stderr,"ERROR: log block marked free in bitmap.\n");
+			exit(1);
+		}
+	}
+}
+
+// a crash can leave a committed transaction in the log, which the kernel
+// installs when it boots.  the checks look at the file system as it will
+// be then: this copies the image to a scratch file, installs the logged
+// blocks there, and returns the scratch file.
+int replayLog(int fd) {
+	struct logheader lh;
+	char buf[BSIZE];
+	int copy, i;
+	FILE* f;
+
+	if(sb->nlog == 0)
+		return fd;
+	if(sb->nlog < NLOG || sb->logstart != sb->size - sb->nlog) {
+		fprintf(stderr,"ERROR: bad log.\n");
+		exit(1);
+	}
+	lseek(fd, sb->logstart * BSIZE, SEEK_SET);
+	read(fd, &lh, sizeof(lh));
+	if(lh.n == 0)
+		return fd;
+	if(lh.n > LOGSIZE) {
+		fprintf(stderr,"ERROR: bad log.\n");
+		exit(1);
+	}
+	printf("fscheck: replaying %d logged blocks\n", lh.n);
+
+	if((f = tmpfile()) == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	copy = fileno(f);
+	lseek(fd, 0, SEEK_SET);
+	for(i = 0; i < imageSize; i++) {
+		read(fd, buf, BSIZE);
+		write(copy, buf, BSIZE);
+	}
+	for(i = 0; i < lh.n; i++) {
+		if(lh.block[i] >= sb->logstart) {
+			fprintf(stderr,"ERROR: bad log.\n");
+			exit(1);
+		}
+		lseek(fd, (sb->logstart + LOGHDR + i) * BSIZE, SEEK_SET);
+		read(fd, buf, BSIZE);
+		lseek(copy, lh.block[i] * BSIZE, SEEK_SET);
+		write(copy, buf, BSIZE);
+	}
+	return copy;
+}
+
 void printBitMap() {
 	int i;
 	for(i = 0; i < numDataBlocks; i++) {	
@@ -1058,6 +1278,7 @@ int main(int argc, char *argv[]) {
 	imageSize = sb->size;
 	numDataBlocks = sb->nblocks;
 	numInodes = sb->ninodes;
+	image = replayLog(image);
         
 	// get inodes
 	inodes = malloc(sizeof(struct dinode*) * numInodes);
@@ -1069,23 +1290,29 @@ int main(int argc, char *argv[]) {
 	
 	// get data bitmap
 	numInodeBlocks = 1 + (int) (numInodes * sizeof(struct dinode)) / BSIZE;
+	numBitmapBlocks = (imageSize + BPB - 1) / BPB;
 	dataBitmapAddr = 2 + numInodeBlocks;
-	beginDataBlocksAddr = 3 + numInodeBlocks;     
+	beginDataBlocksAddr = dataBitmapAddr + numBitmapBlocks;     
+	dataBitmap = malloc(BSIZE * numBitmapBlocks);
 	lseek(image, BSIZE * (dataBitmapAddr), SEEK_SET); // data bitmap location
-	read(image, dataBitmap, BSIZE);
+	read(image, dataBitmap, BSIZE * numBitmapBlocks);
 	
 	// setup helpers
-	inodeHashMap = malloc(sizeof(int) * numInodes);
+	inodeHashMap = malloc(sizeof(int) * imageSize);
 	for(i = 0; i < imageSize; i++)
 		inodeHashMap[i] = 0;
 		
-	inodeHashMap2 = malloc(sizeof(int) * numInodes);
+	inodeHashMap2 = malloc(sizeof(int) * imageSize);
 	for(i = 0; i < imageSize; i++)
 		inodeHashMap2[i] = 0;
 		
-	directoryHashMap = malloc(sizeof(int) * numInodes);
+	directoryHashMap = malloc(sizeof(int) * imageSize);
 	for(i = 0; i < imageSize; i++)
 		directoryHashMap[i] = 0;			
+
+	blockUsedMap = malloc(sizeof(int) * imageSize);
+	for(i = 0; i < imageSize; i++)
+		blockUsedMap[i] = 0;
 		
 	// debug
 	//printBitMap();             
@@ -1103,6 +1330,8 @@ int main(int argc, char *argv[]) {
 	inodeReferredToInDirectoryButMarkedFree(1, 0); // Connor - checked
 	badReferenceCountForFile(); // Jon - checked
 	directoryAppearsMoreThanOnceInFileSystem(1, 0); // Connor 
+	directoryIndexMismatch();
+	logNotMarkedInUse();
 
 	return 0;
 }
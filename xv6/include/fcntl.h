@@ -8,6 +8,8 @@
 #define O_RDWR    	0x002
 #define O_CREATE  	0x200
 #define O_SMALLFILE 0x400
+#define O_EXTENT 	0x800
+#define O_TRUNC 	0x1000
 
 
 #endif //_FCNTL_H_
@@ -7,6 +7,7 @@
 // Block 0 is unused.
 // Block 1 is super block.
 // Inodes start at block 2.
+// The log takes the last nlog blocks of the disk.
 
 #define ROOTINO 1  // root i-number
 #define BSIZE 512  // block size
@@ -16,12 +17,52 @@ struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint nlog;         // Number of log blocks
+  uint logstart;     // Block number of first log block
 };
 
-#define NDIRECT 12
+// The log is LOGHDR blocks of struct logheader, then room for
+// LOGSIZE blocks.  A header with n > 0 is a committed transaction:
+// block[i] is the home of the ith block after the header.
+// The header is written last block first, so the block holding n
+// commits the transaction.
+#define LOGSIZE 320
+#define LOGHDR ((sizeof(uint) * (LOGSIZE + 1) + BSIZE - 1) / BSIZE)
+#define NLOG (LOGHDR + LOGSIZE)
+
+struct logheader {
+  uint n;
+  uint block[LOGSIZE];
+};
+
+// addrs[] holds NDIRECT direct blocks, then the single, double
+// and triple indirect blocks.
+#define NDIRECT 9
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
-#define SMALLFILE_SIZE ((NDIRECT + 1) * 4)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
+#define NADDRS (NDIRECT + 3)
+#define SMALLFILE_SIZE (NADDRS * 4)
+
+// Extent-mapped files (T_EXTENT) use addrs[] as NEXTENT runs of
+// contiguous blocks.  Once those are used, addrs[NADDRS-1] holds
+// the block number of an overflow block of NEXTENTIND more runs.
+// Runs are in file order; the first run with len 0 ends the list.
+struct extent {
+  uint start;   // First block of the run
+  uint len;     // Number of blocks in the run
+};
+
+#define NEXTENT ((NADDRS - 1) / 2)
+#define NEXTENTIND (BSIZE / sizeof(struct extent))
+
+// A file (T_FILE) or directory (T_DIR) with DI_INLINE set in its
+// flags keeps its bytes in addrs[] instead of in data blocks,
+// as a T_SMALLFILE does.  Files and directories start out inline
+// and move to blocks when they grow past SMALLFILE_SIZE; truncating
+// one makes it inline again.
+#define DI_INLINE 0x1
 
 
 // On-disk inode structure
@@ -31,7 +72,9 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  ushort dirindex;      // I-number of hash index (T_DIR), or 0
+  ushort flags;         // DI_* flags
+  uint addrs[NADDRS];   // Data block addresses
 };
 
 // Inodes per block.
@@ -54,4 +97,22 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory that grows to DIRHASHMIN blocks gets a hash index,
+// kept in a T_DIRIDX inode that no directory lists; the directory's
+// dirindex field holds its i-number.  The index is a table of n
+// slots, the index inode's size / 4, probed linearly from
+// dirhash(name) % n.  n is a power of two at least twice the
+// number of dirents the directory had when the table was last
+// built, and at most NDIRIDX.  A slot is 0 if never used,
+// DIRIDX_DEL if its entry was removed, and otherwise the top 16
+// bits of dirhash(name) above 1 + the dirent's number in the
+// directory.  The index inode's minor field counts the slots that
+// are not 0.  dirhash is 32-bit FNV-1a over the name's bytes.
+#define DIRHASHMIN 4
+#define NDIRIDX 2048  // most slots in an index
+#define DIRIDX_DEL 0xffffffff
+#define DIRIDX_MAX(n) ((n) / 4 * 3)  // most slots in use before a rebuild
+#define DIRIDX_TAG(h) ((h) & 0xffff0000)
+#define DIRIDX_ENT(v) (((v) & 0xffff) - 1)
+
 #endif // _FS_H_
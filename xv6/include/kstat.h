@@ -0,0 +1,82 @@
+#ifndef _KSTAT_H_
+#define _KSTAT_H_
+
+// Kernel statistics, for use with the kstat syscall
+
+#define KSTAT_BCACHE 1  // struct bcachestat
+#define KSTAT_IDE    2  // struct idestat
+#define KSTAT_BIO    3  // struct biostat
+#define KSTAT_DCACHE 4  // struct dcachestat
+#define KSTAT_LOG    5  // struct logstat
+
+#define KSTAT_NDEV   3  // disk devices with their own statistics
+
+// Buffer cache
+struct bcachestat {
+  uint nbuf;    // Buffers currently in the cache
+  uint minbuf;  // Cache never shrinks below this
+  uint maxbuf;  // Cache never grows beyond this
+  uint raissued; // Blocks read ahead
+  uint rahits;   // Read-ahead blocks later used
+  uint rawasted; // Read-ahead blocks recycled before use
+  uint policy;   // BPOLICY_LRU or BPOLICY_2Q
+  uint nhot;     // Buffers holding blocks used more than once
+};
+
+// Buffer cache controls, for bcachectl
+#define BCTL_POLICY  1  // set replacement policy; returns the old one
+#define BCTL_MAXBUF  2  // limit the cache to arg buffers; returns the new size
+
+// Replacement policies
+#define BPOLICY_LRU  0  // recycle the least recently used buffer
+#define BPOLICY_2Q   1  // recycle blocks used only once first
+
+// IDE disk queue
+struct idestat {
+  uint nreq;     // Requests queued
+  uint ncmd;     // Disk commands issued (requests after merging)
+  uint depth;    // Requests now queued
+  uint maxdepth; // Most requests ever queued at once
+  uint seek;     // Total sectors moved between commands
+  uint nsweep;   // C-SCAN sweeps completed
+  uint nexpired; // Sweeps cut short for a request past its deadline
+  uint maxwait;  // Longest time a request waited, in ticks
+};
+
+// Buffer cache activity, for one device or in total
+struct biodevstat {
+  uint lookups;    // Blocks asked for
+  uint hits;       // Blocks found in the cache
+  uint misses;     // Blocks given a recycled buffer
+  uint evictions;  // Cached blocks dropped to make room
+  uint sleepticks; // Ticks spent waiting for busy buffers
+  uint writebacks; // Dirty blocks written back by the cache
+};
+
+struct biostat {
+  struct biodevstat dev[KSTAT_NDEV];
+  struct biodevstat total;
+};
+
+// Directory name cache
+struct dcachestat {
+  uint lookups;       // Names looked up
+  uint hits;          // Names found in the cache
+  uint neghits;       // Names the cache knew to be absent
+  uint misses;        // Lookups that had to scan the directory
+  uint evictions;     // Entries dropped to make room
+  uint invalidations; // Entries changed or dropped by directory updates
+};
+
+// File system log
+struct logstat {
+  uint ops;       // Operations begun
+  uint commits;   // Transactions committed
+  uint blocks;    // Blocks written to the log
+  uint absorbed;  // Writes of blocks already in the transaction
+  uint waits;     // Operations that waited for log space
+  uint maxops;    // Most operations in one transaction
+  uint pending;   // Blocks in the transaction not yet committed
+};
+
+#endif // _KSTAT_H_
@@ -8,12 +8,18 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
+#define NBUF        400  // minimum size of disk block cache (> LOGSIZE)
+#define NREADAHEAD   16  // maximum blocks read ahead of a sequential reader
+#define IDEMAXSECT    8  // maximum sectors merged into one IDE command (power of 2, <= 16)
+#define IDEDMA        1  // use bus-master DMA for IDE if the controller has it
+#define NINODE       50  // initial size of the i-node cache
 #define NDEV         10  // maximum major device number
-#define ROOTDEV       1  // device number of file system root disk
+#define ROOTDEV       1  // device number of file system root disk on IDE
+#define VIRTIODEV     2  // device number of the virtio disk (root if present)
+#define NDISK         3  // disk device numbers: IDE 0 and 1, virtio
 #define USERTOP  0xA0000 // end of user address space
 #define PHYSTOP  0x1000000 // use phys mem up to here as free pool
 #define MAXARG       32  // max exec arguments
+#define MAXOPBLOCKS  32  // max # of blocks any FS op writes
 
 #endif // _PARAM_H_
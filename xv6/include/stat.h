@@ -7,6 +7,8 @@
 #define T_FILE 2   		// File
 #define T_DEV  3   		// Special device
 #define T_SMALLFILE  4 	// Small file
+#define T_EXTENT 5 		// File mapped by extents
+#define T_DIRIDX 6 		// Hash index of a directory
 
 struct stat {
   short type;  // Type of file
@@ -16,4 +18,14 @@ struct stat {
   uint size;   // Size of file in bytes
 };
 
+// Statfs struct, for use with statfs syscall
+struct statfs {
+  uint bsize;   // Block size in bytes
+  uint size;    // Blocks in file system
+  uint nblocks; // Data blocks
+  uint bfree;   // Free blocks
+  uint ninodes; // Inodes
+  uint ifree;   // Free inodes
+};
+
 #endif // _STAT_H_
@@ -23,5 +23,10 @@
 #define SYS_sbrk   19
 #define SYS_sleep  20
 #define SYS_uptime 21
+#define SYS_kstat  22
+#define SYS_sync   23
+#define SYS_fsync  24
+#define SYS_bcachectl 25
+#define SYS_statfs 26
 
 #endif // _SYSCALL_H_
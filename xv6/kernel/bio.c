@@ -4,55 +4,480 @@
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
+// Buffers live in hash buckets keyed on (dev, sector), each with its
+// own lock and its own list in least recently used order.  Each
+// bucket also keeps its idle, unpinned buffers on a cold and a hot
+// list, least recently used last, so a miss finds the buffer to
+// recycle by looking at the ends of those lists.
+// The cache is sized at boot from free memory, grows when every
+// buffer is in use, and shrinks when kalloc runs out of pages.
+//
+// By default the cache recycles buffers with a simplified 2Q
+// policy, so that a long sequential read does not push out the
+// superblock, bitmap and inode blocks everyone keeps using.
+// A block starts out cold; if it is looked up again at a later
+// tick it becomes hot (B_HOT).  While cold blocks fill more than
+// a quarter of the cache, the least recently used cold block is
+// recycled; otherwise the least recently used hot one.  A block
+// that was read ahead and then read once is still cold.
+// bcachectl can select plain LRU instead.
 // 
 // Interface:
-// * To get a buffer for a particular disk block, call bread.
+// * To get a buffer for a particular disk block, call bread,
+//     or bclaim if you are about to overwrite all of it.
 // * After changing buffer data, call bwrite to flush it to disk.
 // * When done with the buffer, call brelse.
+// * To force dirty buffers to disk, call bflush.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 // 
-// The implementation uses three state flags internally:
+// * To start reading a block that will be needed soon, call breada.
+// * To have several reads or writes in flight at once, start each
+//     with bread_async or bwrite_async, then call bwait or bwaitany
+//     before using (or releasing) the buffer.
+//
+// The implementation uses these state flags internally:
 // * B_BUSY: the block has been returned from bread
 //     and has not been passed back to brelse.  
 // * B_VALID: the buffer data has been initialized
 //     with the associated disk block contents.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: the disk driver releases the buffer
+//     when its I/O completes.
+// * B_RA: the buffer was read ahead and has not been used yet.
+// * B_HOT: the block was used again after its first use.
+// * B_PIN: the block has been changed by a logged operation and
+//     must not be written to its home until the log commits.
+//     It stays in the cache until the log clears the flag.
+//
+// Device VIRTIODEV is the virtio disk; all others are IDE disks.
+//
+// The file system writes through the log (see log.c), which pins
+// the buffers it changes until it commits.  The bflushd kernel
+// process commits the log every BFLUSHTICKS ticks.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "kstat.h"
 
-struct {
+#define NBUCKET 31
+#define BHASH(dev, sector) (((dev) ^ (sector)) % NBUCKET)
+#define BFLUSHTICKS 100  // ticks between periodic write-backs
+
+// Disk driver entry points for a buf's device.
+static void
+diskrw(struct buf *b)
+{
+  if(b->dev == VIRTIODEV)
+    virtiorw(b);
+  else
+    iderw(b);
+}
+
+static void
+disksubmit(struct buf *b)
+{
+  if(b->dev == VIRTIODEV)
+    virtiosubmit(b);
+  else
+    idesubmit(b);
+}
+
+static int
+diskwaitany(struct buf **bp, int n)
+{
+  if(bp[0]->dev == VIRTIODEV)
+    return virtiowaitany(bp, n);
+  return idewaitany(bp, n);
+}
+
+// Buffers are carved out of whole pages of physical memory,
+// so the cache can grow while there is free memory and give
+// pages back to kalloc when memory runs short.
+#define BPP ((PGSIZE - sizeof(void*)) / sizeof(struct buf))
+
+struct bufpage {
+  struct bufpage *next;
+  struct buf buf[BPP];
+};
+
+// Each hash bucket has its own lock, so lookups and releases
+// of blocks in different buckets never touch a shared lock.
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Buffers in this bucket, through prev/next.
   // head.next is most recently used.
   struct buf head;
+
+  // Read-ahead statistics for blocks in this bucket.
+  uint raissued;
+  uint rahits;
+  uint rawasted;
+
+  // Activity on blocks in this bucket, by device.
+  struct biodevstat stat[KSTAT_NDEV];
+
+  uint nhot;  // buffers with B_HOT set
+
+  // Idle buffers that are not pinned, cold ([0]) and hot ([1]),
+  // circular through lprev/lnext; lru[i] is most recently used.
+  struct buf *lru[2];
+};
+
+struct {
+  // Held while moving a buffer to another bucket or
+  // adding and removing pages, so only misses take it.
+  struct spinlock lock;
+  struct bufpage *pages;  // all pages holding buffers
+  int nbuf;               // number of buffers in the cache
+  int maxbuf;             // never grow beyond this many buffers
+  int nspare;             // spreads new buffers over the buckets
+  int flushreq;           // ask bflushd to write back early
+  int policy;             // BPOLICY_LRU or BPOLICY_2Q
+
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Put b at the front (most recently used end) of bucket bk.
+// Caller must hold bk->lock.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->bucket = bk - bcache.bucket;
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Put b at the back (least recently used end) of bucket bk.
+// Caller must hold bk->lock.
+static void
+bappend(struct bucket *bk, struct buf *b)
+{
+  b->bucket = bk - bcache.bucket;
+  b->prev = bk->head.prev;
+  b->next = &bk->head;
+  bk->head.prev->next = b;
+  bk->head.prev = b;
+}
+
+// Remove b from its bucket.  Caller must hold the bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Put idle buffer b on its bucket's cold or hot list: at the
+// most recently used end, or at the other if back is set.
+// Caller must hold the bucket's lock.
+static void
+lput(struct buf *b, int back)
+{
+  struct buf **lp, *h;
+
+  lp = &bcache.bucket[b->bucket].lru[(b->flags & B_HOT) != 0];
+  if((h = *lp) == 0){
+    b->lnext = b->lprev = b;
+    *lp = b;
+    return;
+  }
+  b->lnext = h;
+  b->lprev = h->lprev;
+  h->lprev->lnext = b;
+  h->lprev = b;
+  if(!back)
+    *lp = b;
+}
+
+// Take b off its cold or hot list, if it is on one.
+// Caller must hold its bucket's lock.
+static void
+ldel(struct buf *b)
+{
+  struct buf **lp;
+
+  if(b->lnext == 0)
+    return;
+  lp = &bcache.bucket[b->bucket].lru[(b->flags & B_HOT) != 0];
+  if(b->lnext == b)
+    *lp = 0;
+  else {
+    b->lnext->lprev = b->lprev;
+    b->lprev->lnext = b->lnext;
+    if(*lp == b)
+      *lp = b->lnext;
+  }
+  b->lnext = b->lprev = 0;
+}
+
+// Clear b's B_HOT flag.  Caller must hold its bucket's lock.
+static void
+bcool(struct buf *b)
+{
+  if(b->flags & B_HOT){
+    b->flags &= ~B_HOT;
+    bcache.bucket[b->bucket].nhot--;
+  }
+}
+
+// Wake processes waiting in bget for b to be released.
+// Only they sleep on b with its bucket lock, so skip the
+// shared wakeup when there are none.
+static void
+bwakeup(struct buf *b)
+{
+  if(b->waiting)
+    wakeup(b);
+}
+
+// Add b as an idle buffer holding no block.
+// Caller must hold bcache.lock.
+static void
+bspare(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = &bcache.bucket[bcache.nspare++ % NBUCKET];
+  acquire(&bk->lock);
+  b->flags = 0;
+  b->dev = -1;
+  b->waiting = 0;
+  b->lastuse = 0;
+  bappend(bk, b);
+  lput(b, 1);
+  release(&bk->lock);
+}
+
+// Add the buffers on page p to the cache.
+// Caller must hold bcache.lock.
+static void
+baddpage(struct bufpage *p)
+{
+  struct buf *b;
+
+  p->next = bcache.pages;
+  bcache.pages = p;
+  for(b = p->buf; b < p->buf+BPP; b++)
+    bspare(b);
+  bcache.nbuf += BPP;
+}
+
+// Size the cache from the memory kinit found free:
+// start with a sixteenth of it, allow up to a quarter.
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *bk;
+  int npages, want;
+  char *mem;
 
   initlock(&bcache.lock, "bcache");
+  bcache.policy = BPOLICY_2Q;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  npages = kfreepages();
+  bcache.maxbuf = npages/4 * BPP;
+  if(bcache.maxbuf < NBUF + BPP)
+    bcache.maxbuf = NBUF + BPP;
+  want = npages/16 * BPP;
+  if(want < NBUF)
+    want = NBUF;
+  while(bcache.nbuf < want && bcache.nbuf + BPP <= bcache.maxbuf){
+    if((mem = kalloc()) == 0)
+      break;
+    acquire(&bcache.lock);
+    baddpage((struct bufpage*)mem);
+    release(&bcache.lock);
+  }
+  if(bcache.nbuf < NBUF)
+    panic("binit: no memory for buffers");
+}
+
+// Grow the cache by one page of buffers.
+// Returns 0 if the cache is at its maximum size or memory is short.
+// Caller must hold bcache.lock; it is released while allocating.
+static int
+bgrow(void)
+{
+  char *mem;
+
+  if(bcache.nbuf + BPP > bcache.maxbuf)
+    return 0;
+  release(&bcache.lock);
+  mem = kalloc();
+  acquire(&bcache.lock);
+  if(mem == 0)
+    return 0;
+  baddpage((struct bufpage*)mem);
+  return 1;
+}
+
+// Give one page of idle buffers back to the page allocator.
+// Called by kalloc when it runs out of memory.
+// Returns 1 if a page was freed, 0 otherwise.
+int
+bshrink(void)
+{
+  struct bufpage *p, **pp;
+  struct bucket *bk;
+  struct buf *b, *b1;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    b->dev = -1;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  acquire(&bcache.lock);
+  if(bcache.nbuf - BPP < NBUF){
+    release(&bcache.lock);
+    return 0;
+  }
+  for(pp = &bcache.pages; (p = *pp) != 0; pp = &p->next){
+    // Take each buffer on p out of its bucket.  No one can
+    // find it once it is unlinked, so it must be idle, clean,
+    // and have no bget still about to look at it.
+    for(b = p->buf; b < p->buf+BPP; b++){
+      bk = &bcache.bucket[b->bucket];
+      acquire(&bk->lock);
+      if((b->flags & (B_BUSY|B_DIRTY|B_PIN)) || b->waiting){
+        release(&bk->lock);
+        break;
+      }
+      ldel(b);
+      bcool(b);
+      bunlink(b);
+      release(&bk->lock);
+    }
+    if(b < p->buf+BPP){
+      // Some buffer is in use.  Put the ones already taken back
+      // in their buckets, still holding their blocks; misses wait
+      // for bcache.lock, so none has looked for them meanwhile.
+      for(b1 = p->buf; b1 < b; b1++){
+        bk = &bcache.bucket[b1->bucket];
+        acquire(&bk->lock);
+        bappend(bk, b1);
+        lput(b1, 1);
+        release(&bk->lock);
+      }
+      continue;
+    }
+    *pp = p->next;
+    bcache.nbuf -= BPP;
+    release(&bcache.lock);
+    kfree((char*)p);
+    return 1;
   }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Choose an idle buffer to recycle: the least recently used one,
+// or under 2Q, the least recently used cold or hot one.
+// Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *k;
+  struct buf *b, *best[2];
+  uint nhot;
+  int hot;
+
+  best[0] = best[1] = 0;
+  nhot = 0;
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    acquire(&k->lock);
+    nhot += k->nhot;
+    for(hot = 0; hot < 2; hot++){
+      if(k->lru[hot] == 0)
+        continue;
+      // Only a write-back by bflush or brecycle leaves a busy
+      // buffer on a list, so this passes over few if any.
+      for(b = k->lru[hot]->lprev; b->flags & B_BUSY; b = b->lprev)
+        if(b == k->lru[hot])
+          break;
+      if(!(b->flags & B_BUSY) &&
+         (best[hot] == 0 || b->lastuse < best[hot]->lastuse))
+        best[hot] = b;
+    }
+    release(&k->lock);
+  }
+  if(bcache.policy != BPOLICY_2Q){
+    if(best[0] && best[1])
+      return best[0]->lastuse <= best[1]->lastuse ? best[0] : best[1];
+    return best[0] ? best[0] : best[1];
+  }
+  if(best[0] && (best[1] == 0 || bcache.nbuf - nhot > bcache.nbuf/4))
+    return best[0];
+  return best[1];
+}
+
+// Recycle an idle buffer (see bvictim) and
+// give it to sector on device dev in bucket bk, setting *bp.
+// Returns 1 on success and 0 if every buffer is busy.
+// Returns -1 if the victim was taken or had to be written back
+// first; the caller must then look for the block again.
+// Caller must hold bcache.lock.
+static int
+brecycle(struct bucket *bk, uint dev, uint sector, struct buf **bp)
+{
+  struct bucket *vk;
+  struct buf *b, *victim;
+
+  if((victim = bvictim()) == 0)
+    return 0;
+
+  // A hit may have taken the victim since its bucket was unlocked,
+  // but holding bcache.lock keeps it from changing buckets.
+  b = victim;
+  vk = &bcache.bucket[b->bucket];
+  acquire(&vk->lock);
+  if(b->flags & (B_BUSY|B_PIN)){
+    release(&vk->lock);
+    return -1;
+  }
+  if(b->flags & B_DIRTY){
+    // Write the victim back first, and have bflushd
+    // clean the others before we run into them too.
+    b->flags |= B_BUSY;
+    bcache.flushreq = 1;
+    release(&vk->lock);
+    release(&bcache.lock);
+    diskrw(b);
+    acquire(&vk->lock);
+    vk->stat[b->dev].writebacks++;
+    b->flags &= ~B_BUSY;
+    bwakeup(b);
+    release(&vk->lock);
+    acquire(&bcache.lock);
+    return -1;
+  }
+  if(b->flags & B_RA)
+    vk->rawasted++;
+  if(b->flags & B_VALID)
+    vk->stat[b->dev].evictions++;
+  ldel(b);
+  bcool(b);
+  bunlink(b);
+  release(&vk->lock);
+
+  b->dev = dev;
+  b->sector = sector;
+  b->flags = B_BUSY;
+  acquire(&bk->lock);
+  bpush(bk, b);
+  bk->stat[dev].misses++;
+  release(&bk->lock);
+  *bp = b;
+  return 1;
 }
 
 // Look through buffer cache for sector on device dev.
@@ -61,35 +486,171 @@ binit(void)
 static struct buf*
 bget(uint dev, uint sector)
 {
+  struct bucket *bk;
   struct buf *b;
+  uint t0;
+  int r;
 
-  acquire(&bcache.lock);
+  if(dev >= KSTAT_NDEV)
+    panic("bget: dev");
+  bk = &bcache.bucket[BHASH(dev, sector)];
+  acquire(&bk->lock);
+  bk->stat[dev].lookups++;
 
  loop:
   // Try for cached block.
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->sector == sector){
       if(!(b->flags & B_BUSY)){
+        ldel(b);
+        if(b->flags & B_RA){
+          b->flags &= ~B_RA;
+          bk->rahits++;
+        } else if(!(b->flags & B_HOT) && (b->flags & B_VALID) &&
+                  b->lastuse != ticks){
+          // Used again, and not just by the same operation.
+          b->flags |= B_HOT;
+          bk->nhot++;
+        }
         b->flags |= B_BUSY;
-        release(&bcache.lock);
+        bk->stat[dev].hits++;
+        release(&bk->lock);
         return b;
       }
-      sleep(b, &bcache.lock);
+      t0 = ticks;
+      b->waiting++;
+      sleep(b, &bk->lock);
+      b->waiting--;
+      bk->stat[dev].sleepticks += ticks - t0;
       goto loop;
     }
   }
+  release(&bk->lock);
 
-  // Allocate fresh block.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if((b->flags & B_BUSY) == 0){
-      b->dev = dev;
-      b->sector = sector;
-      b->flags = B_BUSY;
+  // Allocate fresh block.  Blocks only enter buckets with
+  // bcache.lock held, so look once more while holding it.
+  acquire(&bcache.lock);
+  for(;;){
+    acquire(&bk->lock);
+    for(b = bk->head.next; b != &bk->head; b = b->next)
+      if(b->dev == dev && b->sector == sector)
+        break;
+    if(b != &bk->head){
+      release(&bcache.lock);
+      goto loop;
+    }
+    release(&bk->lock);
+
+    if((r = brecycle(bk, dev, sector, &b)) > 0){
       release(&bcache.lock);
       return b;
     }
+    if(r == 0 && !bgrow()){
+      // Every buffer is in use and the cache cannot grow:
+      // wait a tick for some to be released.
+      release(&bcache.lock);
+      acquire(&tickslock);
+      sleep(&ticks, &tickslock);
+      release(&tickslock);
+      acquire(&bcache.lock);
+    }
+  }
+}
+
+// Report the current size of the cache and its statistics.
+void
+bstat(struct bcachestat *st)
+{
+  struct bucket *bk;
+
+  acquire(&bcache.lock);
+  st->nbuf = bcache.nbuf;
+  st->minbuf = NBUF;
+  st->maxbuf = bcache.maxbuf;
+  release(&bcache.lock);
+
+  st->policy = bcache.policy;
+  st->raissued = st->rahits = st->rawasted = st->nhot = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    st->raissued += bk->raissued;
+    st->rahits += bk->rahits;
+    st->rawasted += bk->rawasted;
+    st->nhot += bk->nhot;
+    release(&bk->lock);
+  }
+}
+
+// Select the replacement policy.  Returns the old one, or -1.
+int
+bsetpolicy(int policy)
+{
+  int old;
+
+  if(policy != BPOLICY_LRU && policy != BPOLICY_2Q)
+    return -1;
+  acquire(&bcache.lock);
+  old = bcache.policy;
+  bcache.policy = policy;
+  release(&bcache.lock);
+  return old;
+}
+
+// Keep the cache at no more than n buffers, writing back and
+// freeing pages of buffers until it fits or every remaining page
+// has a buffer in use.  Returns the new size of the cache.
+int
+bsetmax(int n)
+{
+  int nbuf;
+
+  if(n < NBUF + BPP)
+    n = NBUF + BPP;
+  acquire(&bcache.lock);
+  bcache.maxbuf = n;
+  release(&bcache.lock);
+
+  bflush(-1);
+  do {
+    acquire(&bcache.lock);
+    nbuf = bcache.nbuf;
+    release(&bcache.lock);
+  } while(nbuf > n && bshrink());
+  return nbuf;
+}
+
+// Report buffer cache activity for each device and in total.
+void
+biostat(struct biostat *st)
+{
+  struct bucket *bk;
+  struct biodevstat *s, *t;
+  int dev;
+
+  memset(st, 0, sizeof(*st));
+  t = &st->total;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    for(dev = 0; dev < KSTAT_NDEV; dev++){
+      s = &st->dev[dev];
+      s->lookups += bk->stat[dev].lookups;
+      s->hits += bk->stat[dev].hits;
+      s->misses += bk->stat[dev].misses;
+      s->evictions += bk->stat[dev].evictions;
+      s->sleepticks += bk->stat[dev].sleepticks;
+      s->writebacks += bk->stat[dev].writebacks;
+    }
+    release(&bk->lock);
+  }
+  for(dev = 0; dev < KSTAT_NDEV; dev++){
+    s = &st->dev[dev];
+    t->lookups += s->lookups;
+    t->hits += s->hits;
+    t->misses += s->misses;
+    t->evictions += s->evictions;
+    t->sleepticks += s->sleepticks;
+    t->writebacks += s->writebacks;
   }
-  panic("bget: no buffers");
 }
 
 // Return a B_BUSY buf with the contents of the indicated disk sector.
@@ -100,10 +661,92 @@ bread(uint dev, uint sector)
 
   b = bget(dev, sector);
   if(!(b->flags & B_VALID))
-    iderw(b);
+    diskrw(b);
+  return b;
+}
+
+// Return a B_BUSY buf for the indicated disk sector without
+// reading it from disk.  The caller must overwrite all of its data
+// before releasing it, since the buffer counts as valid.
+struct buf*
+bclaim(uint dev, uint sector)
+{
+  struct buf *b;
+
+  b = bget(dev, sector);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Return a B_BUSY buf for the indicated disk sector, and start
+// reading its contents if they are not cached, without waiting.
+// Call bwait before using the data.
+struct buf*
+bread_async(uint dev, uint sector)
+{
+  struct buf *b;
+
+  b = bget(dev, sector);
+  if(!(b->flags & B_VALID))
+    disksubmit(b);
   return b;
 }
 
+// Wait for the I/O started by bread_async or bwrite_async on b.
+void
+bwait(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bwait");
+  diskwaitany(&b, 1);
+}
+
+// Wait for the I/O started on at least one of the n bufs
+// in bp, and return its index.
+int
+bwaitany(struct buf **bp, int n)
+{
+  int i;
+
+  if(n <= 0)
+    panic("bwaitany");
+  for(i = 1; i < n; i++)
+    if(bp[i]->dev != bp[0]->dev)
+      panic("bwaitany: mixed devices");
+  return diskwaitany(bp, n);
+}
+
+// Start reading sector on device dev into the cache, without
+// waiting for it.  Does nothing if the block is already cached.
+void
+breada(uint dev, uint sector)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = &bcache.bucket[BHASH(dev, sector)];
+  acquire(&bk->lock);
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->sector == sector){
+      release(&bk->lock);
+      return;
+    }
+  }
+  release(&bk->lock);
+
+  b = bget(dev, sector);
+  if(b->flags & B_VALID){
+    // Someone else read it in meanwhile.
+    brelse(b);
+    return;
+  }
+  acquire(&bk->lock);
+  bk->raissued++;
+  b->flags |= B_ASYNC|B_RA;
+  release(&bk->lock);
+  disksubmit(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,28 +754,91 @@ bwrite(struct buf *b)
   if((b->flags & B_BUSY) == 0)
     panic("bwrite");
   b->flags |= B_DIRTY;
-  iderw(b);
+  diskrw(b);
+}
+
+// Start writing b's contents to disk, without waiting.
+// Must be locked; call bwait before brelse.
+void
+bwrite_async(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0)
+    panic("bwrite_async");
+  b->flags |= B_DIRTY;
+  disksubmit(b);
 }
 
 // Release the buffer b.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if((b->flags & B_BUSY) == 0)
     panic("brelse");
 
-  acquire(&bcache.lock);
+  // A busy buffer never changes buckets.
+  bk = &bcache.bucket[b->bucket];
+  acquire(&bk->lock);
 
-  b->next->prev = b->prev;
-  b->prev->next = b->next;
-  b->next = bcache.head.next;
-  b->prev = &bcache.head;
-  bcache.head.next->prev = b;
-  bcache.head.next = b;
+  bunlink(b);
+  bpush(bk, b);
+  b->lastuse = ticks;
 
   b->flags &= ~B_BUSY;
-  wakeup(b);
+  if(!(b->flags & B_PIN))
+    lput(b, 0);
+  bwakeup(b);
 
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
+// Write every dirty buffer of device dev (or of all devices,
+// if dev < 0) to disk, oldest first within each bucket.
+void
+bflush(int dev)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    for(b = bk->head.prev; b != &bk->head; b = b->prev){
+      if((b->flags & (B_BUSY|B_DIRTY|B_PIN)) != B_DIRTY)
+        continue;
+      if(dev >= 0 && b->dev != dev)
+        continue;
+      // Holding b busy keeps it in the bucket while the lock is
+      // dropped, so b->prev is still the right place to continue.
+      b->flags |= B_BUSY;
+      release(&bk->lock);
+      diskrw(b);
+      acquire(&bk->lock);
+      bk->stat[b->dev].writebacks++;
+      b->flags &= ~B_BUSY;
+      bwakeup(b);
+    }
+    release(&bk->lock);
+  }
+  bcache.flushreq = 0;
+}
+
+// Buffer cache write-back process.
+// Commits the file system log and flushes dirty buffers every
+// BFLUSHTICKS ticks, or sooner if bget finds itself recycling
+// dirty buffers.
+void
+bflushd(void)
+{
+  uint ticks0;
+
+  for(;;){
+    acquire(&tickslock);
+    ticks0 = ticks;
+    while(ticks - ticks0 < BFLUSHTICKS && !bcache.flushreq)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    log_flush();
+    bflush(-1);
+  }
+}
@@ -5,13 +5,23 @@ struct buf {
   int flags;
   uint dev;
   uint sector;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // LRU list of hash bucket
   struct buf *next;
+  int bucket;       // hash bucket holding this buf
+  struct buf *lprev; // bucket's cold or hot list, while idle
+  struct buf *lnext;
+  int waiting;      // processes waiting for B_BUSY to clear
+  uint lastuse;     // ticks at last brelse
   struct buf *qnext; // disk queue
+  uint qtime;       // ticks when queued for disk
   uchar data[512];
 };
 #define B_BUSY  0x1  // buffer is locked by some process
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // release buffer when disk I/O completes
+#define B_RA    0x10 // read ahead and not yet used
+#define B_HOT   0x20 // used again after its first use
+#define B_PIN   0x40 // in the log and not yet installed on disk
 
 #endif // _BUF_H_
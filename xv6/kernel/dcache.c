@@ -0,0 +1,203 @@
+// Directory name cache.
+//
+// The name cache remembers the results of dirlookup, keyed on
+// (dev, directory i-number, name), so that resolving the same
+// path again does not rescan the directory blocks.  An entry
+// either gives the i-number and dirent offset the name maps to,
+// or (inum 0) records that the directory has no such name.
+//
+// The cache is kept exact rather than timed out: everyone who
+// changes a directory holds its inode lock and tells the cache.
+// dirlink enters the new name, unlink turns its entry negative,
+// and freeing a directory inode purges every entry under it,
+// since its i-number may come back as a different directory.
+// Entries live in a hash table and on a least recently used
+// list; a new entry takes the place of the least recently used.
+//
+// Interface:
+// * dcachelookup: 1 and the i-number on a hit, 0 if the name is
+//     known to be absent, -1 if the cache does not know.
+// * dcacheenter: record what a directory scan or change found.
+// * dcachepurge: forget everything under a directory.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "kstat.h"
+
+#define NDENTRY 256
+#define NDHASH 61
+
+struct dentry {
+  uint dev;
+  uint dinum;           // i-number of the directory
+  char name[DIRSIZ];
+  uint inum;            // i-number name maps to; 0 if absent
+  uint off;             // offset of its dirent in the directory
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;    // lru.next is most recently used
+  struct dcachestat stat;
+} dcache;
+
+static uint
+dhash(uint dev, uint dinum, char *name)
+{
+  uint h;
+  int i;
+
+  h = dev ^ dinum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+// Move d to the front of the LRU list.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  d->next->prev = d;
+  d->prev->next = d;
+}
+
+// Take d out of its hash chain.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dinum, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dinum = 0;
+}
+
+// Find the entry for name in directory (dev, dinum).
+// Caller must hold dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dinum, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dev, dinum, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dinum == dinum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.entry; d < dcache.entry+NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+// Look name up in directory (dev, dinum).
+// Return 1 and set *inum and *off if it is there,
+// 0 if it is known not to be, and -1 if the cache cannot tell.
+int
+dcachelookup(uint dev, uint dinum, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+  int r;
+
+  acquire(&dcache.lock);
+  dcache.stat.lookups++;
+  if((d = dfind(dev, dinum, name)) == 0){
+    dcache.stat.misses++;
+    r = -1;
+  } else if(d->inum == 0){
+    dcache.stat.neghits++;
+    dtouch(d);
+    r = 0;
+  } else {
+    dcache.stat.hits++;
+    *inum = d->inum;
+    *off = d->off;
+    dtouch(d);
+    r = 1;
+  }
+  release(&dcache.lock);
+  return r;
+}
+
+// Record that name in directory (dev, dinum) is the dirent at off
+// for inum, or, if inum is 0, that there is no such name.
+// Caller must hold the directory locked.
+void
+dcacheenter(uint dev, uint dinum, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dev, dinum, name)) == 0){
+    // Take over the least recently used entry.
+    d = dcache.lru.prev;
+    if(d->dinum != 0){
+      dunhash(d);
+      dcache.stat.evictions++;
+    }
+    d->dev = dev;
+    d->dinum = dinum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(dev, dinum, name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  } else if(d->inum != inum){
+    dcache.stat.invalidations++;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget every name in directory (dev, dinum).
+void
+dcachepurge(uint dev, uint dinum)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry+NDENTRY; d++){
+    if(d->dinum == dinum && d->dev == dev){
+      dunhash(d);
+      dcache.stat.invalidations++;
+    }
+  }
+  release(&dcache.lock);
+}
+
+void
+dcachestat(struct dcachestat *st)
+{
+  acquire(&dcache.lock);
+  *st = dcache.stat;
+  release(&dcache.lock);
+}
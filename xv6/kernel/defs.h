@@ -1,20 +1,40 @@
 #ifndef _DEFS_H_
 #define _DEFS_H_
 
+struct bcachestat;
+struct biostat;
+struct idestat;
 struct buf;
 struct context;
+struct dcachestat;
+struct logstat;
 struct file;
 struct inode;
+struct pcidev;
 struct pipe;
 struct proc;
 struct spinlock;
 struct stat;
+struct statfs;
 
 // bio.c
 void            binit(void);
+void            breada(uint, uint);
+struct buf*     bclaim(uint, uint);
+void            bflush(int);
+void            bflushd(void) __attribute__((noreturn));
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
 void            brelse(struct buf*);
+int             bshrink(void);
+void            bstat(struct bcachestat*);
+int             bsetmax(int);
+int             bsetpolicy(int);
+void            biostat(struct biostat*);
+void            bwait(struct buf*);
+int             bwaitany(struct buf**, int);
 void            bwrite(struct buf*);
+void            bwrite_async(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -22,6 +42,13 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 
+// dcache.c
+void            dcacheinit(void);
+void            dcacheenter(uint, uint, char*, uint, uint);
+int             dcachelookup(uint, uint, char*, uint*, uint*);
+void            dcachepurge(uint, uint);
+void            dcachestat(struct dcachestat*);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -35,13 +62,18 @@ int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
 
 // fs.c
+extern uint     rootdev;
+void            fsstat(uint, struct statfs*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+void            dirunlink(struct inode*, char*, uint);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+int             isdirempty(struct inode*);
 void            iinit(void);
 void            ilock(struct inode*);
 void            iput(struct inode*);
+void            itrunc(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
@@ -49,6 +81,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            iprefetch(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -56,6 +89,9 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idesubmit(struct buf*);
+int             idewaitany(struct buf**, int);
+void            idestat(struct idestat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,6 +101,7 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+int             kfreepages(void);
 void            kinit(void);
 
 // kbd.c
@@ -78,12 +115,28 @@ void            lapicinit(int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
+// log.c
+void            loginit(void);
+void            logrecover(uint);
+void            begin_op(void);
+void            end_op(void);
+void            log_flush(void);
+void            log_write(struct buf*);
+void            logstat(struct logstat*);
+
 // mp.c
 extern int      ismp;
 int             mpbcpu(void);
 void            mpinit(void);
 void            mpstartthem(void);
 
+// pci.c
+uint            pciconfread(struct pcidev*, int);
+void            pciconfwrite(struct pcidev*, int, uint);
+void            pcienable(struct pcidev*);
+int             pcifindclass(int, int, struct pcidev*);
+int             pcifindid(int, int, struct pcidev*);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -100,6 +153,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+void            kthread(char*, void(*)(void));
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -153,6 +207,14 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+extern int      virtioirq;
+int             virtioinit(void);
+void            virtiointr(void);
+void            virtiorw(struct buf*);
+void            virtiosubmit(struct buf*);
+int             virtiowaitany(struct buf**, int);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -67,8 +67,11 @@ fileclose(struct file *f)
   
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
-  else if(ff.type == FD_INODE)
+  else if(ff.type == FD_INODE){
+    begin_op();
     iput(ff.ip);
+    end_op();
+  }
 }
 
 // Get metadata about file f.
@@ -108,18 +111,39 @@ fileread(struct file *f, char *addr, int n)
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  int r, i, n1, max;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = writei(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-    return r;
+    // Write a few blocks at a time, each in an operation of its
+    // own, so as not to overflow the log: the blocks, plus their
+    // inode, indirect blocks and bitmap blocks, must fit in
+    // MAXOPBLOCKS.
+    max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    r = 0;
+    i = 0;
+    while(i < n){
+      n1 = n - i;
+      if(n1 > max)
+        n1 = max;
+
+      begin_op();
+      ilock(f->ip);
+      if((r = writei(f->ip, addr + i, f->off, n1)) > 0)
+        f->off += r;
+      iunlock(f->ip);
+      end_op();
+
+      if(r <= 0)
+        break;
+      i += r;
+      if(r != n1)
+        break;
+    }
+    return i > 0 ? i : r;
   }
   panic("filewrite");
 }
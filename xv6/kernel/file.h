@@ -18,13 +18,23 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  struct inode *hnext; // icache hash chain
+  struct inode *prev;  // icache list of unreferenced inodes
+  struct inode *next;
+
+  uint ranext;        // block a sequential reader would read next
+  uint raend;         // blocks before this have been read ahead
+  uint rawin;         // read-ahead window, in blocks
+  uint dirfree;       // no free dirent before this offset (T_DIR)
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  ushort dirindex;
+  ushort dflags;      // dinode flags, DI_*
+  uint addrs[NADDRS];
 };
 
 #define I_BUSY 0x1
@@ -4,8 +4,13 @@
 //   + Directories: inode with special contents (list of other inodes!)
 //   + Names: paths like /usr/rtm/xv6/fs.c for convenient naming.
 //
-// Disk layout is: superblock, inodes, block in-use bitmap, data blocks.
+// Disk layout is: superblock, inodes, block in-use bitmap, data blocks,
+// log.
 //
+// Every change to the disk goes through the log (log.c), so a file
+// system operation either happens entirely or not at all, and the
+// routines here that change blocks must be called inside begin_op
+// and end_op.
 // This file contains the low-level file system manipulation 
 // routines.  The (higher-level) system call implementations
 // are in sysfile.c.
@@ -22,17 +27,123 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-static void itrunc(struct inode*);
+#define NBATCH 8  // blocks readi has in flight at once
+
+uint rootdev = ROOTDEV;  // device holding the root file system
+
+// In-memory copy of each disk's super block, with a summary
+// of free space so that balloc need not scan the whole bitmap.
+// nfree and bfree[] count free blocks; balloc reserves a block
+// by decrementing them before it looks in the bitmap block,
+// so it is sure to find one there.  hint[] is where the last
+// search of each bitmap block ended.
+// The first ialloc also builds a map of the free inodes,
+// which ialloc and iput keep up to date.
+#define NBMAP 64     // most bitmap blocks a file system may have
+#define NIMAP 8192   // most inodes a file system may have
+
+struct fsinfo {
+  int state;                  // 0, FS_LOADING or FS_VALID
+  struct superblock sb;
+  uint nbmap;                 // bitmap blocks
+  uint nfree;                 // free blocks
+  uint bfree[NBMAP];          // free blocks per bitmap block
+  uint hint[NBMAP];           // next bit to try, per bitmap block
+  uint cur;                   // bitmap block to try first
+
+  int istate;                 // inode map: 0, FS_LOADING or FS_VALID
+  uint nifree;                // free inodes
+  uint ihint;                 // next inum to try
+  uint imap[NIMAP/32];        // bit set if inode is in use
+  uint ifreed[NIMAP/32];      // inodes freed while the map loads
+};
+#define FS_LOADING 1
+#define FS_VALID   2
+
+static struct {
+  struct spinlock lock;
+  struct fsinfo fs[NDISK];
+} fscache;
 
-// Read the super block.
-static void
-readsb(int dev, struct superblock *sb)
+// Count the free blocks covered by bitmap block i.
+static uint
+bcount(uint dev, struct superblock *sb, uint i)
 {
   struct buf *bp;
-  
+  uint n, bi, bound;
+
+  bound = min(sb->size - i*BPB, BPB);
+  bp = bread(dev, BBLOCK(i*BPB, sb->ninodes));
+  n = 0;
+  for(bi = 0; bi < bound; bi++)
+    if((bp->data[bi/8] & (1 << (bi%8))) == 0)
+      n++;
+  brelse(bp);
+  return n;
+}
+
+// Return dev's super block and free space summary,
+// reading them in the first time.
+static struct fsinfo*
+getfs(uint dev)
+{
+  struct fsinfo *fs;
+  struct buf *bp;
+  uint i;
+
+  if(dev >= NDISK)
+    panic("getfs: dev");
+  fs = &fscache.fs[dev];
+  acquire(&fscache.lock);
+  while(fs->state == FS_LOADING)
+    sleep(fs, &fscache.lock);
+  if(fs->state == FS_VALID){
+    release(&fscache.lock);
+    return fs;
+  }
+  fs->state = FS_LOADING;
+  release(&fscache.lock);
+
   bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  memmove(&fs->sb, bp->data, sizeof(fs->sb));
   brelse(bp);
+  fs->nbmap = (fs->sb.size + BPB - 1) / BPB;
+  if(fs->nbmap > NBMAP)
+    panic("getfs: bitmap too big");
+  fs->nfree = 0;
+  for(i = 0; i < fs->nbmap; i++){
+    fs->bfree[i] = bcount(dev, &fs->sb, i);
+    fs->hint[i] = 0;
+    fs->nfree += fs->bfree[i];
+  }
+  fs->cur = 0;
+
+  acquire(&fscache.lock);
+  fs->state = FS_VALID;
+  wakeup(fs);
+  release(&fscache.lock);
+  return fs;
+}
+
+static void imapload(uint, struct fsinfo*);
+
+// Report the size and free space of the file system on dev.
+void
+fsstat(uint dev, struct statfs *st)
+{
+  struct fsinfo *fs;
+
+  fs = getfs(dev);
+  if(fs->istate != FS_VALID)
+    imapload(dev, fs);
+  acquire(&fscache.lock);
+  st->bsize = BSIZE;
+  st->size = fs->sb.size;
+  st->nblocks = fs->sb.nblocks;
+  st->bfree = fs->nfree;
+  st->ninodes = fs->sb.ninodes;
+  st->ifree = fs->nifree;
+  release(&fscache.lock);
 }
 
 // Zero a block.
@@ -41,68 +152,160 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
   
-  bp = bread(dev, bno);
+  bp = bclaim(dev, bno);
   memset(bp->data, 0, BSIZE);
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
 // Blocks. 
 
-// Allocate a disk block.
+// Find a clear bit in the bitmap block data, looking at no more
+// than bound bits and starting at bit hint: first the rest of
+// hint's word, then a word at a time, wrapping around.
+// Returns the bit number, or -1 if all are set.
+static int
+bscan(uchar *data, uint bound, uint hint)
+{
+  uint *w, wi, nw, bi, i;
+
+  w = (uint*)data;
+  nw = (bound + 31) / 32;
+  if(hint >= bound)
+    hint = 0;
+  for(bi = hint; bi < bound && (bi == hint || bi%32 != 0); bi++)
+    if((w[bi/32] & (1 << (bi%32))) == 0)
+      return bi;
+  wi = (hint / 32 + 1) % nw;
+  for(i = 0; i < nw; i++, wi = (wi + 1) % nw){
+    if(w[wi] == 0xffffffff)
+      continue;
+    for(bi = wi*32; bi < wi*32 + 32 && bi < bound; bi++)
+      if((w[wi] & (1 << (bi%32))) == 0)
+        return bi;
+  }
+  return -1;
+}
+
+// Allocate a zeroed disk block, as close after block goal as
+// possible.  A goal of 0 means no preference.
 static uint
-balloc(uint dev)
+ballocnear(uint dev, uint goal)
 {
-  int b, bi, m, bound;
+  struct fsinfo *fs;
   struct buf *bp;
-  struct superblock sb;
-  
-  bp = 0;
-  readsb(dev, &sb);
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb.ninodes));
-    
-    if(b+BPB > sb.size){ //last bitmap block
-      bound = sb.size % BPB;
-    } else {
-      bound = BPB;
-    }
-    
-    for(bi = 0; bi < bound; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use on disk.
-        bwrite(bp);
-        brelse(bp);
-        return b + bi;
-      }
-    }
-    brelse(bp);
+  uint i, n, hint;
+  int bi;
+
+  fs = getfs(dev);
+
+  // Reserve a free block in some bitmap block,
+  // preferring the one that covers goal.
+  acquire(&fscache.lock);
+  if(fs->nfree == 0){
+    release(&fscache.lock);
+    //panic("balloc: out of blocks");
+    return 0;
   }
-  
-  //panic("balloc: out of blocks");
-  return 0;
+  if(goal > 0 && goal < fs->sb.size && fs->bfree[goal/BPB] > 0){
+    i = goal / BPB;
+    hint = goal % BPB;
+  } else {
+    for(n = 0, i = fs->cur; fs->bfree[i] == 0; i = (i + 1) % fs->nbmap)
+      if(++n > fs->nbmap)
+        panic("balloc: free count");
+    fs->cur = i;
+    hint = fs->hint[i];
+  }
+  fs->bfree[i]--;
+  fs->nfree--;
+  release(&fscache.lock);
+
+  bp = bread(dev, BBLOCK(i*BPB, fs->sb.ninodes));
+  bi = bscan(bp->data, min(fs->sb.size - i*BPB, BPB), hint);
+  if(bi < 0)
+    panic("balloc: bitmap");
+  bp->data[bi/8] |= 1 << (bi%8);  // Mark block in use on disk.
+  fs->hint[i] = bi + 1;
+  log_write(bp);
+  brelse(bp);
+  bzero(dev, i*BPB + bi);
+  return i*BPB + bi;
 }
 
-// Free a disk block.
+// Allocate a disk block.
+static uint
+balloc(uint dev)
+{
+  return ballocnear(dev, 0);
+}
+
+// Blocks are freed in batches.  A batch holds on to the bitmap
+// block of the last block it freed, so freeing a run of blocks
+// covered by one bitmap block reads and logs that block and
+// updates the free counts just once.  Freed blocks are not
+// zeroed; ballocnear zeroes blocks as it hands them out.
+struct freebatch {
+  uint dev;
+  struct fsinfo *fs;
+  struct buf *bp;     // bitmap block being changed, or 0
+  uint i;             // bp's number among the bitmap blocks
+  uint n;             // blocks freed in bp so far
+};
+
 static void
-bfree(int dev, uint b)
+fbstart(struct freebatch *fb, uint dev)
 {
-  struct buf *bp;
-  struct superblock sb;
-  int bi, m;
+  fb->dev = dev;
+  fb->fs = getfs(dev);
+  fb->bp = 0;
+}
 
-  bzero(dev, b);
+// Log the batch's bitmap block and count the blocks freed in it.
+static void
+fbdone(struct freebatch *fb)
+{
+  if(fb->bp == 0)
+    return;
+  log_write(fb->bp);
+  brelse(fb->bp);
+  fb->bp = 0;
+
+  acquire(&fscache.lock);
+  fb->fs->bfree[fb->i] += fb->n;
+  fb->fs->nfree += fb->n;
+  release(&fscache.lock);
+}
+
+// Add block b to the batch.
+static void
+fbadd(struct freebatch *fb, uint b)
+{
+  int bi, m;
 
-  readsb(dev, &sb);
-  bp = bread(dev, BBLOCK(b, sb.ninodes));
+  if(fb->bp == 0 || b / BPB != fb->i){
+    fbdone(fb);
+    fb->i = b / BPB;
+    fb->n = 0;
+    fb->bp = bread(fb->dev, BBLOCK(b, fb->fs->sb.ninodes));
+  }
   bi = b % BPB;
   m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
+  if((fb->bp->data[bi/8] & m) == 0)
     panic("freeing free block");
-  bp->data[bi/8] &= ~m;  // Mark block free on disk.
-  bwrite(bp);
-  brelse(bp);
+  fb->bp->data[bi/8] &= ~m;  // Mark block free on disk.
+  fb->n++;
+}
+
+// Free a disk block.
+static void
+bfree(int dev, uint b)
+{
+  struct freebatch fb;
+
+  fbstart(&fb, dev);
+  fbadd(&fb, b);
+  fbdone(&fb);
 }
 
 // Inodes.
@@ -119,7 +322,11 @@ bfree(int dev, uint b)
 // 
 // ip->ref counts the number of pointer references to this cached
 // inode; references are typically kept in struct file and in proc->cwd.
-// When ip->ref falls to zero, the inode is no longer cached.
+// When ip->ref falls to zero, the inode stays cached, and valid,
+// on a least recently used list until iget needs the slot for
+// another inode.  iget finds inodes through a hash table on
+// (dev, inum).  If every cached inode is referenced, iget adds
+// another page of them.
 // It is an error to use an inode without holding a reference to it.
 //
 // Processes are only allowed to read and write inode
@@ -138,42 +345,238 @@ bfree(int dev, uint b)
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) ^ (inum)) % NIHASH)
+
+// Inodes are carved out of whole pages, like buffers.
+#define IPP ((PGSIZE - sizeof(void*)) / sizeof(struct inode))
+
+struct inodepage {
+  struct inodepage *next;
+  struct inode inode[IPP];
+};
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chained through hnext
+  struct inode lru;            // unreferenced inodes, through prev/next;
+                               // lru.next is most recently used
+  struct inodepage *pages;
+  int ninode;
 } icache;
 
+// Put ip on the unreferenced list: at the front, or at the
+// back if its contents are not worth keeping.
+// Caller must hold icache.lock.
+static void
+ilruadd(struct inode *ip, int front)
+{
+  if(front){
+    ip->next = icache.lru.next;
+    ip->prev = &icache.lru;
+  } else {
+    ip->next = &icache.lru;
+    ip->prev = icache.lru.prev;
+  }
+  ip->next->prev = ip;
+  ip->prev->next = ip;
+}
+
+// Take ip off the unreferenced list.  Caller must hold icache.lock.
+static void
+ilrudel(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+// Remove ip from the hash table, if it is there.
+// Caller must hold icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  if(ip->inum == 0)
+    return;
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      return;
+    }
+  }
+  panic("iunhash");
+}
+
+// Add a page of unused inodes to the cache.
+// Returns 0 if there is no memory for it.
+static int
+igrow(void)
+{
+  struct inodepage *p;
+  struct inode *ip;
+
+  if((p = (struct inodepage*)kalloc()) == 0)
+    return 0;
+  memset(p, 0, PGSIZE);
+  acquire(&icache.lock);
+  p->next = icache.pages;
+  icache.pages = p;
+  for(ip = p->inode; ip < p->inode+IPP; ip++)
+    ilruadd(ip, 0);
+  icache.ninode += IPP;
+  release(&icache.lock);
+  return 1;
+}
+
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache");
+  initlock(&fscache.lock, "fscache");
+  icache.lru.prev = icache.lru.next = &icache.lru;
+  while(icache.ninode < NINODE)
+    if(!igrow())
+      panic("iinit");
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Build fs's map of free inodes, reading each inode block once.
+static void
+imapload(uint dev, struct fsinfo *fs)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint inum;
+
+  acquire(&fscache.lock);
+  while(fs->istate == FS_LOADING)
+    sleep(&fs->istate, &fscache.lock);
+  if(fs->istate == FS_VALID){
+    release(&fscache.lock);
+    return;
+  }
+  if(fs->sb.ninodes > NIMAP)
+    panic("imapload: too many inodes");
+  // Clear the map before anyone can see FS_LOADING,
+  // so an ifree from now on is not lost.
+  memset(fs->imap, 0, sizeof(fs->imap));
+  memset(fs->ifreed, 0, sizeof(fs->ifreed));
+  fs->imap[0] = 1;  // inode 0 is never used
+  fs->nifree = 0;
+  fs->istate = FS_LOADING;
+  release(&fscache.lock);
+
+  bp = 0;
+  for(inum = 1; inum < fs->sb.ninodes; inum++){
+    if(bp == 0 || inum % IPB == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, IBLOCK(inum));
+    }
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      fs->imap[inum/32] |= 1 << (inum%32);
+    else
+      fs->nifree++;
+  }
+  if(bp)
+    brelse(bp);
+  fs->ihint = 1;
+
+  acquire(&fscache.lock);
+  // An inode freed after the scan read its block is still
+  // marked in use; ifree noted it in ifreed.
+  for(inum = 1; inum < fs->sb.ninodes; inum++){
+    if((fs->ifreed[inum/32] & (1 << (inum%32))) &&
+       (fs->imap[inum/32] & (1 << (inum%32)))){
+      fs->imap[inum/32] &= ~(1 << (inum%32));
+      fs->nifree++;
+    }
+  }
+  fs->istate = FS_VALID;
+  wakeup(&fs->istate);
+  release(&fscache.lock);
+}
+
+// Take a free inum from fs's inode map, or return 0.
+// Caller must hold fscache.lock.
+static uint
+imapalloc(struct fsinfo *fs)
+{
+  uint nw, wi, i, inum;
+
+  if(fs->nifree == 0)
+    return 0;
+  nw = (fs->sb.ninodes + 31) / 32;
+  wi = fs->ihint / 32 % nw;
+  for(i = 0; i < nw; i++, wi = (wi + 1) % nw){
+    if(fs->imap[wi] == 0xffffffff)
+      continue;
+    for(inum = wi*32; inum < wi*32 + 32 && inum < fs->sb.ninodes; inum++){
+      if((fs->imap[wi] & (1 << (inum%32))) == 0){
+        fs->imap[wi] |= 1 << (inum%32);
+        fs->nifree--;
+        fs->ihint = inum + 1;
+        return inum;
+      }
+    }
+  }
+  panic("imapalloc: free count");
+}
+
 // Allocate a new inode with the given type on device dev.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
-  struct superblock sb;
+  struct fsinfo *fs;
+
+  fs = getfs(dev);
+  if(fs->istate != FS_VALID)
+    imapload(dev, fs);
+  for(;;){
+    acquire(&fscache.lock);
+    inum = imapalloc(fs);
+    release(&fscache.lock);
+    if(inum == 0)
+      panic("ialloc: no inodes");
 
-  readsb(dev, &sb);
-  for(inum = 1; inum < sb.ninodes; inum++){  // loop over inode blocks
     bp = bread(dev, IBLOCK(inum));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
-      bwrite(bp);   // mark it allocated on the disk
+      if(type == T_FILE || type == T_DIR)
+        dip->flags = DI_INLINE;
+      log_write(bp); // mark it allocated on the disk
       brelse(bp);
       return iget(dev, inum);
     }
+    // The map was wrong; it now says the inode is in use.
     brelse(bp);
   }
-  panic("ialloc: no inodes");
+}
+
+// Mark inode inum on dev free in the inode map, or if the
+// map is being loaded, note it for imapload to apply.
+static void
+ifree(uint dev, uint inum)
+{
+  struct fsinfo *fs;
+
+  fs = getfs(dev);
+  acquire(&fscache.lock);
+  if(fs->istate == FS_LOADING)
+    fs->ifreed[inum/32] |= 1 << (inum%32);
+  else if(fs->istate == FS_VALID && (fs->imap[inum/32] & (1 << (inum%32)))){
+    fs->imap[inum/32] &= ~(1 << (inum%32));
+    fs->nifree++;
+  }
+  release(&fscache.lock);
 }
 
 // Copy inode, which has changed, from memory to disk.
@@ -190,8 +593,10 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  dip->dirindex = ip->dirindex;
+  dip->flags = ip->dflags;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
-  bwrite(bp);
+  log_write(bp);
   brelse(bp);
 }
 
@@ -200,31 +605,40 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **bucket;
 
   acquire(&icache.lock);
 
+ loop:
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  bucket = &icache.hash[IHASH(dev, inum)];
+  for(ip = *bucket; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        ilrudel(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Allocate fresh inode.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Recycle the least recently used unreferenced inode.
+  if((ip = icache.lru.prev) == &icache.lru){
+    release(&icache.lock);
+    if(!igrow())
+      panic("iget: no inodes");
+    acquire(&icache.lock);
+    goto loop;
+  }
+  ilrudel(ip);
+  iunhash(ip);
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->flags = 0;
+  ip->ranext = ip->raend = ip->rawin = 0;
+  ip->hnext = *bucket;
+  *bucket = ip;
   release(&icache.lock);
 
   return ip;
@@ -265,8 +679,11 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
+    ip->dirindex = dip->dirindex;
+    ip->dflags = dip->flags;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->dirfree = 0;
     ip->flags |= I_VALID;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -286,6 +703,8 @@ iunlock(struct inode *ip)
   release(&icache.lock);
 }
 
+static void idxdrop(struct inode*);
+
 // Caller holds reference to unlocked ip.  Drop reference.
 void
 iput(struct inode *ip)
@@ -297,14 +716,20 @@ iput(struct inode *ip)
       panic("iput busy");
     ip->flags |= I_BUSY;
     release(&icache.lock);
+    if(ip->type == T_DIR){
+      dcachepurge(ip->dev, ip->inum);
+      idxdrop(ip);
+    }
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    ifree(ip->dev, ip->inum);
     acquire(&icache.lock);
     ip->flags = 0;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0)
+    ilruadd(ip, ip->flags & I_VALID);
   release(&icache.lock);
 }
 
@@ -321,15 +746,139 @@ iunlockput(struct inode *ip)
 // The contents (data) associated with each inode is stored
 // in a sequence of blocks on the disk.  The first NDIRECT blocks
 // are listed in ip->addrs[].  The next NINDIRECT blocks are 
-// listed in the block ip->addrs[NDIRECT].
+// listed in the block ip->addrs[NDIRECT], the NDINDIRECT after
+// those in the blocks listed in the double indirect block
+// ip->addrs[NDIRECT+1], and the last NTINDIRECT through the
+// triple indirect block ip->addrs[NDIRECT+2].
+// An extent-mapped file (T_EXTENT) instead keeps a list of runs;
+// see struct extent in fs.h.  An inline inode has no blocks at all:
+// its bytes are addrs[] itself.
+
+// Does ip keep its contents in ip->addrs?
+static int
+iinline(struct inode *ip)
+{
+  if(ip->type == T_SMALLFILE)
+    return 1;
+  return (ip->type == T_FILE || ip->type == T_DIR) && (ip->dflags & DI_INLINE);
+}
+
+// Return the disk block address of the nth block in extent-mapped
+// inode ip.  Blocks are only ever added at the end of the file:
+// bmapext extends the last run if the block after it is free and
+// starts a new run otherwise.  Returns 0 if the disk or the run
+// list is full.
+static uint
+bmapext(struct inode *ip, uint bn)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint i, addr;
+
+  e = (struct extent*)ip->addrs;
+  last = 0;
+  for(i = 0; i < NEXTENT && e[i].len > 0; i++){
+    if(bn < e[i].len)
+      return e[i].start + bn;
+    bn -= e[i].len;
+    last = &e[i];
+  }
+
+  bp = 0;
+  if(i == NEXTENT && ip->addrs[NADDRS-1]){
+    bp = bread(ip->dev, ip->addrs[NADDRS-1]);
+    e = (struct extent*)bp->data;
+    for(i = 0; i < NEXTENTIND && e[i].len > 0; i++){
+      if(bn < e[i].len){
+        addr = e[i].start + bn;
+        brelse(bp);
+        return addr;
+      }
+      bn -= e[i].len;
+      last = &e[i];
+    }
+  }
+  if(bn != 0)
+    panic("bmapext: hole");
+
+  addr = ballocnear(ip->dev, last ? last->start + last->len : 0);
+  if(addr == 0)
+    goto out;
+  if(last && addr == last->start + last->len){
+    last->len++;
+  } else if(bp == 0 && i < NEXTENT){
+    e[i].start = addr;
+    e[i].len = 1;
+  } else {
+    // Start a run in the overflow block, allocating it first.
+    if(bp == 0){
+      if((ip->addrs[NADDRS-1] = balloc(ip->dev)) == 0){
+        bfree(ip->dev, addr);
+        return 0;
+      }
+      bp = bread(ip->dev, ip->addrs[NADDRS-1]);
+      e = (struct extent*)bp->data;
+      i = 0;
+    }
+    if(i == NEXTENTIND){
+      bfree(ip->dev, addr);
+      addr = 0;
+      goto out;
+    }
+    e[i].start = addr;
+    e[i].len = 1;
+  }
+  // Write the runs out now, so that they never lag
+  // behind the blocks the bitmap says are allocated.
+  if(bp)
+    log_write(bp);
+  iupdate(ip);
+out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Return the disk block address of block bn in the tree of
+// indirect blocks of the given depth rooted at *root,
+// allocating any missing blocks along the way.
+static uint
+bmapind(struct inode *ip, uint *root, int depth, uint bn)
+{
+  uint addr, span, *a;
+  struct buf *bp;
+
+  if((addr = *root) == 0 && (*root = addr = balloc(ip->dev)) == 0)
+    return 0;
+  for(span = 1; --depth > 0; )
+    span *= NINDIRECT;
+  for(; span > 0; span /= NINDIRECT){
+    bp = bread(ip->dev, addr);
+    a = (uint*)bp->data;
+    if((addr = a[bn / span]) == 0){
+      a[bn / span] = addr = balloc(ip->dev);
+      log_write(bp);
+    }
+    brelse(bp);
+    if(addr == 0)
+      return 0;
+    bn %= span;
+  }
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, n;
+  int depth;
+
+  if(iinline(ip))
+    panic("bmap: inline");
+  if(ip->type == T_EXTENT)
+    return bmapext(ip, bn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
@@ -338,56 +887,166 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      bwrite(bp);
-    }
-    brelse(bp);
-    return addr;
+  // Single, then double, then triple indirect.
+  for(depth = 1, n = NINDIRECT; depth <= 3; depth++, n *= NINDIRECT){
+    if(bn < n)
+      return bmapind(ip, &ip->addrs[NDIRECT+depth-1], depth, bn);
+    bn -= n;
   }
 
   panic("bmap: out of range");
 }
 
-// Truncate inode (discard contents).
-// Only called after the last dirent referring
-// to this inode has been erased on disk.
+// Add the blocks of the runs e[0..n-1] to batch fb.
 static void
-itrunc(struct inode *ip)
+efree(struct freebatch *fb, struct extent *e, int n)
+{
+  int i;
+  uint b;
+
+  for(i = 0; i < n && e[i].len > 0; i++)
+    for(b = e[i].start; b < e[i].start + e[i].len; b++)
+      fbadd(fb, b);
+}
+
+// Discard the contents of extent-mapped inode ip.
+static void
+itruncext(struct inode *ip)
+{
+  struct freebatch fb;
+  struct buf *bp;
+
+  bp = 0;
+  if(ip->addrs[NADDRS-1])
+    bp = bread_async(ip->dev, ip->addrs[NADDRS-1]);
+
+  fbstart(&fb, ip->dev);
+  efree(&fb, (struct extent*)ip->addrs, NEXTENT);
+
+  if(bp){
+    bwait(bp);
+    efree(&fb, (struct extent*)bp->data, NEXTENTIND);
+    brelse(bp);
+    fbadd(&fb, ip->addrs[NADDRS-1]);
+  }
+  fbdone(&fb);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+
+  ip->size = 0;
+  iupdate(ip);
+}
+
+// Add the blocks listed in indirect block bp, which is at the
+// given depth, then bp's block itself, to batch fb.  Releases bp.
+static void
+ifreeind(struct freebatch *fb, struct buf *bp, int depth)
+{
+  uint *a, b;
+  int j;
+
+  a = (uint*)bp->data;
+  if(depth > 1){
+    // Start reading all the blocks below before walking them.
+    for(j = 0; j < NINDIRECT; j++)
+      if(a[j])
+        breada(fb->dev, a[j]);
+  }
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      ifreeind(fb, bread(fb->dev, a[j]), depth - 1);
+    else
+      fbadd(fb, a[j]);
+  }
+  b = bp->sector;
+  brelse(bp);
+  fbadd(fb, b);
+}
+
+// Move inline inode ip's bytes out to a data block so that it
+// can grow past SMALLFILE_SIZE.  Returns -1 if the disk is full.
+// Caller must hold ip locked.
+static int
+ipromote(struct inode *ip)
 {
-  int i, j;
+  char data[SMALLFILE_SIZE];
+  short type;
+  ushort dflags;
   struct buf *bp;
-  uint *a;
+  uint addr;
+
+  memmove(data, ip->addrs, sizeof(data));
+  type = ip->type;
+  dflags = ip->dflags;
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  if(ip->type == T_SMALLFILE)
+    ip->type = T_FILE;
+  ip->dflags &= ~DI_INLINE;
+  if(ip->size > 0){
+    if((addr = bmap(ip, 0)) == 0){
+      memmove(ip->addrs, data, sizeof(data));
+      ip->type = type;
+      ip->dflags = dflags;
+      return -1;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, data, ip->size);
+    log_write(bp);
+    brelse(bp);
+  }
+  iupdate(ip);
+  return 0;
+}
+
+// Truncate inode (discard contents).  A file or directory
+// is left inline, so it costs no blocks until it grows again.
+// Caller must hold ip locked.
+void
+itrunc(struct inode *ip)
+{
+  int i;
+  struct buf *bp[3];
+  struct freebatch fb;
   
-  if(ip->type == T_SMALLFILE) {
-	  return;
+  if(iinline(ip)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+
+  if(ip->type == T_EXTENT){
+    itruncext(ip);
+    return;
+  }
+
+  // Read the indirect blocks while freeing the direct ones.
+  for(i = 0; i < 3; i++){
+    bp[i] = 0;
+    if(ip->addrs[NDIRECT+i])
+      bp[i] = bread_async(ip->dev, ip->addrs[NDIRECT+i]);
   }
 
+  fbstart(&fb, ip->dev);
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      fbadd(&fb, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
   
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < 3; i++){
+    if(bp[i]){
+      bwait(bp[i]);
+      ifreeind(&fb, bp[i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
+  fbdone(&fb);
 
+  if(ip->type == T_FILE || ip->type == T_DIR)
+    ip->dflags |= DI_INLINE;
   ip->size = 0;
   iupdate(ip);
 }
@@ -403,13 +1062,64 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Having read n bytes at off, start reading the blocks a
+// sequential reader will want next.  The window doubles, up to
+// NREADAHEAD blocks, while reads stay sequential and closes as
+// soon as one is not.  Caller must hold ip locked.
+static void
+readahead(struct inode *ip, uint off, uint n)
+{
+  uint bn, last, end, nblocks;
+
+  bn = off / BSIZE;
+  last = (off + n - 1) / BSIZE;
+  if(bn == ip->ranext || bn + 1 == ip->ranext){
+    ip->rawin = ip->rawin ? min(2*ip->rawin, NREADAHEAD) : 2;
+  } else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ranext = last + 1;
+  if(ip->rawin == 0)
+    return;
+
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = min(last + 1 + ip->rawin, nblocks);
+  if(ip->raend < last + 1)
+    ip->raend = last + 1;
+  for(; ip->raend < end; ip->raend++)
+    breada(ip->dev, bmap(ip, ip->raend));
+}
+
+// Start reading up to NREADAHEAD blocks of ip's data
+// from offset off, without waiting for them.
+// Caller must hold ip locked.
+void
+iprefetch(struct inode *ip, uint off, uint n)
+{
+  uint bn, last, addr;
+
+  if(ip->type != T_FILE && ip->type != T_DIR && ip->type != T_EXTENT)
+    return;
+  if(iinline(ip))
+    return;
+  if(n == 0 || off >= ip->size)
+    return;
+  if(off + n > ip->size)
+    n = ip->size - off;
+  last = min((off + n - 1) / BSIZE, off / BSIZE + NREADAHEAD - 1);
+  for(bn = off / BSIZE; bn <= last; bn++)
+    if((addr = bmap(ip, bn)) != 0)
+      breada(ip->dev, addr);
+}
+
 // Read data from inode.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
-  int i;
+  uint tot, m, bn, last;
+  struct buf *bp, *batch[NBATCH];
+  int nb, bi;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -417,45 +1127,42 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return devsw[ip->major].read(ip, dst, n);
   }
   
-  if(ip->type == T_SMALLFILE) {	  
-	  if(off > SMALLFILE_SIZE /*ip->size*/ || off + n < off) 		{
-          	return -1;
-	  }
-	  
-	  if(off + n > SMALLFILE_SIZE) {
-          	n = SMALLFILE_SIZE - off;
-          } 
-          	
-          if(off + n > ip->size)  {
-          	n = ip->size - off;
-          }
-
-	  for(i = off; i < off + n; i++) {
-		  int indexOffset = i % 4;
-	      int indexBase = i / 4;
-		  
-  		  uint temp = ip->addrs[indexBase];
-		  temp = temp >> (indexOffset * 8);
-		  temp = temp & 0xFF;	   
-		  dst[i - off] = temp;
-	  }	  
+  if(iinline(ip)) {
+	  if(off > ip->size || off + n < off)
+		return -1;
+	  if(off + n > ip->size)
+		n = ip->size - off;
+	  memmove(dst, (char*)ip->addrs + off, n);
   } else {
 	  if(off > ip->size || off + n < off)
 		return -1;
 	  if(off + n > ip->size)
 		n = ip->size - off;
 
+	  // Start reading up to NBATCH blocks at once,
+	  // then copy them out in order as they arrive.
+	  nb = bi = 0;
 	  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-		uint sector_number = bmap(ip, off/BSIZE);
-		if(sector_number == 0){ //failed to find block
-		  panic("readi: trying to read a block that was never allocated");
+		if(bi == nb){
+		  last = min((off + n - tot - 1)/BSIZE, off/BSIZE + NBATCH - 1);
+		  for(nb = 0, bn = off/BSIZE; bn <= last; bn++){
+			uint sector_number = bmap(ip, bn);
+			if(sector_number == 0){ //failed to find block
+			  panic("readi: trying to read a block that was never allocated");
+			}
+			batch[nb++] = bread_async(ip->dev, sector_number);
+		  }
+		  bi = 0;
 		}
 		
-		bp = bread(ip->dev, sector_number);
+		bp = batch[bi++];
+		bwait(bp);
 		m = min(n - tot, BSIZE - off%BSIZE);
 		memmove(dst, bp->data + off%BSIZE, m);
 		brelse(bp);
 	  }
+	  if(n > 0)
+		readahead(ip, off - n, n);
   }
   
   return n;
@@ -467,7 +1174,6 @@ writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
-  int i;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -475,31 +1181,24 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
   
-  if(ip->type == T_SMALLFILE) {
-	  if(off > SMALLFILE_SIZE /*ip->size*/ || off + n < off) 
-          	return -1;
-	  if(off + n > SMALLFILE_SIZE) 
-          n = SMALLFILE_SIZE - off; 
-
-	  for(i = off; i < off + n; i++) {
-		int indexOffset = i % 4;
-		int indexBase = i / 4;
-
-		uint filter = ~(0xFF << (indexOffset * 8));  
-		uint temp = ip->addrs[indexBase];
-		temp = (temp & filter);	   
-		uint data = src[i - off];
-		data = data << (indexOffset * 8);		
-		temp = temp | data;	  
-		ip->addrs[indexBase] = temp;
-	  }		  
-		  
-	  ip->size = off + n;	  
+  // An inline inode that would outgrow addrs[] moves to blocks.
+  if(iinline(ip) && off <= ip->size && off + n > SMALLFILE_SIZE){
+	  if(ipromote(ip) < 0)
+		  return -1;
+  }
+
+  if(iinline(ip)) {
+	  if(off > ip->size || off + n < off)
+		return -1;
+	  memmove((char*)ip->addrs + off, src, n);
+	  if(off + n > ip->size)
+		ip->size = off + n;
 	  iupdate(ip);
   } else {
 	  if(off > ip->size || off + n < off)
 		return -1;
-	  if(off + n > MAXFILE*BSIZE)
+	  // Extent-mapped files end where bmap runs out of runs.
+	  if(ip->type != T_EXTENT && off + n > MAXFILE*BSIZE)
 		n = MAXFILE*BSIZE - off;
 
 	  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
@@ -509,10 +1208,13 @@ writei(struct inode *ip, char *src, uint off, uint n)
 		  break;
 		}
 		
-		bp = bread(ip->dev, sector_number);
 		m = min(n - tot, BSIZE - off%BSIZE);
+		if(m == BSIZE)
+		  bp = bclaim(ip->dev, sector_number);  // overwriting all of it
+		else
+		  bp = bread(ip->dev, sector_number);
 		memmove(bp->data + off%BSIZE, src, m);
-		bwrite(bp);
+		log_write(bp);
 		brelse(bp);
 	  }
 
@@ -532,70 +1234,475 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-// Caller must have already locked dp.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+// Directory iteration, a block at a time.  dirget returns the
+// entry at it->off, reading its block only when it->off moves
+// into another one, or 0 past the end of the directory.  dirdone
+// releases the block; dirget does so itself at the end.  An inline
+// directory's entries are in dp->addrs, and it->bp stays 0.
+// A typical walk:
+//
+//   for(dirstart(&it, dp, 0); (de = dirget(&it)) != 0; it.off += sizeof(*de))
+//     ...
+//   dirdone(&it);
+//
+// Changes made through a returned entry must be followed by
+// dirmod(&it).  Caller must hold dp locked.
+
+struct dirit {
+  struct inode *dp;
+  struct buf *bp;     // block holding the entry at off
+  uint blk;           // bp's block number within dp
+  uint off;           // offset of the current entry
+};
+
+static void
+dirstart(struct dirit *it, struct inode *dp, uint off)
 {
-  uint off, inum;
-  struct buf *bp;
+  it->dp = dp;
+  it->bp = 0;
+  it->off = off;
+}
+
+static void
+dirdone(struct dirit *it)
+{
+  if(it->bp){
+    brelse(it->bp);
+    it->bp = 0;
+  }
+}
+
+static struct dirent*
+dirget(struct dirit *it)
+{
+  struct inode *dp;
+  int walking;
+
+  dp = it->dp;
+  if(it->off >= dp->size){
+    dirdone(it);
+    return 0;
+  }
+  if(iinline(dp))
+    return (struct dirent*)((char*)dp->addrs + it->off);
+  if(it->bp == 0 || it->blk != it->off / BSIZE){
+    // A walk that has moved on from one block will want the next.
+    walking = it->bp != 0;
+    dirdone(it);
+    it->blk = it->off / BSIZE;
+    it->bp = bread(dp->dev, bmap(dp, it->blk));
+    if(walking && (it->blk + 1) * BSIZE < dp->size)
+      breada(dp->dev, bmap(dp, it->blk + 1));
+  }
+  return (struct dirent*)(it->bp->data + it->off % BSIZE);
+}
+
+// Write back the entry dirget last returned, which has changed.
+static void
+dirmod(struct dirit *it)
+{
+  if(it->bp)
+    log_write(it->bp);
+  else
+    iupdate(it->dp);
+}
+
+// Hashed directories.
+//
+// See DIRHASHMIN in fs.h for the format.  The index inode is only
+// used while its directory is locked, so it needs no locking of
+// its own beyond ilock to load it.  An index that fills up with
+// removed entries or whose directory has grown is rebuilt, at twice
+// the size if the directory needs it; one that would outgrow NDIRIDX
+// is dropped and the directory goes back to being scanned.
+
+#define IDXPB (BSIZE / sizeof(uint))  // index slots per block
+
+struct idxcur {
+  struct inode *xp;   // index inode
+  struct buf *bp;     // block holding the current slot
+  uint blk;           // bp's block number within the index
+  uint nslot;         // slots in the index
+};
+
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Return a pointer to slot i of the index, keeping its block
+// in the cursor until the cursor moves to another block.
+static uint*
+idxslot(struct idxcur *c, uint i)
+{
+  if(c->bp == 0 || c->blk != i / IDXPB){
+    if(c->bp)
+      brelse(c->bp);
+    c->blk = i / IDXPB;
+    c->bp = bread(c->xp->dev, bmap(c->xp, c->blk));
+  }
+  return (uint*)c->bp->data + i % IDXPB;
+}
+
+// Open dp's index, locking the index inode.
+// Return 0 if dp has none.
+static int
+idxopen(struct inode *dp, struct idxcur *c)
+{
+  if(dp->dirindex == 0)
+    return 0;
+  c->xp = iget(dp->dev, dp->dirindex);
+  ilock(c->xp);
+  if(c->xp->type != T_DIRIDX)
+    panic("idxopen: not an index");
+  c->bp = 0;
+  c->nslot = c->xp->size / sizeof(uint);
+  return 1;
+}
+
+static void
+idxclose(struct idxcur *c)
+{
+  if(c->bp)
+    brelse(c->bp);
+  iunlockput(c->xp);
+}
+
+// Add the dirent for name at off to the index.
+// Return -1 if the index has no room for it.
+static int
+idxadd(struct idxcur *c, char *name, uint off)
+{
+  uint h, i, n, *sp;
+
+  if(off / sizeof(struct dirent) + 1 >= 0xffff)
+    return -1;
+  h = dirhash(name);
+  for(n = 0, i = h % c->nslot; n < c->nslot; n++, i = (i + 1) % c->nslot){
+    sp = idxslot(c, i);
+    if(*sp == 0 || *sp == DIRIDX_DEL){
+      if(*sp == 0){
+        if(c->xp->minor >= DIRIDX_MAX(c->nslot))
+          return -1;
+        c->xp->minor++;
+      }
+      *sp = DIRIDX_TAG(h) | (off / sizeof(struct dirent) + 1);
+      log_write(c->bp);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// Drop dp's index; dp goes back to being scanned.
+static void
+idxdrop(struct inode *dp)
+{
+  struct inode *xp;
+
+  if(dp->dirindex == 0)
+    return;
+  xp = iget(dp->dev, dp->dirindex);
+  ilock(xp);
+  xp->nlink = 0;
+  iupdate(xp);
+  dp->dirindex = 0;
+  iupdate(dp);
+  iunlockput(xp);
+}
+
+// Return the number of slots an index of dp's dirents should
+// have: twice as many, rounded up to a power of two, and never
+// fewer than its index has now.  Return 0 if that is too many.
+static uint
+idxsize(struct inode *dp, uint cur)
+{
+  uint n;
+
+  for(n = IDXPB; n < cur || n < 2 * (dp->size / sizeof(struct dirent)); n *= 2)
+    ;
+  return n <= NDIRIDX ? n : 0;
+}
+
+// Give dp a fresh index of every name in it, creating the
+// index inode if dp has none and growing it if dp has grown.
+static void
+idxbuild(struct inode *dp)
+{
+  struct idxcur c;
+  struct dirit it;
   struct dirent *de;
+  uint i, nslot;
+
+  if(dp->dirindex == 0){
+    if((nslot = idxsize(dp, 0)) == 0)
+      return;
+    c.xp = ialloc(dp->dev, T_DIRIDX);
+    ilock(c.xp);
+    c.xp->nlink = 1;
+    dp->dirindex = c.xp->inum;
+    iupdate(dp);
+    c.bp = 0;
+  } else {
+    idxopen(dp, &c);
+    if((nslot = idxsize(dp, c.nslot)) == 0){
+      idxclose(&c);
+      idxdrop(dp);
+      return;
+    }
+  }
+  c.xp->size = nslot * sizeof(uint);
+  c.nslot = nslot;
 
-  if(dp->type != T_DIR)
-    panic("dirlookup not DIR");
+  for(i = 0; i < nslot; i += IDXPB){
+    memset(idxslot(&c, i), 0, BSIZE);
+    log_write(c.bp);
+  }
+  c.xp->minor = 0;
+
+  for(dirstart(&it, dp, 0); (de = dirget(&it)) != 0; it.off += sizeof(*de)){
+    if(de->inum == 0)
+      continue;
+    if(idxadd(&c, de->name, it.off) < 0){
+      dirdone(&it);
+      iupdate(c.xp);
+      idxclose(&c);
+      idxdrop(dp);
+      return;
+    }
+  }
+  iupdate(c.xp);
+  idxclose(&c);
+}
 
-  for(off = 0; off < dp->size; off += BSIZE){
+// Look name up in dp's index.  Return 1 and set *inum and *poff
+// if it is there, 0 if it is not, and -1 if dp has no index.
+static int
+idxlookup(struct inode *dp, char *name, uint *inum, uint *poff)
+{
+  struct idxcur c;
+  struct buf *bp;
+  struct dirent *de;
+  uint h, i, n, v, off;
+
+  if(!idxopen(dp, &c))
+    return -1;
+  h = dirhash(name);
+  for(n = 0, i = h % c.nslot; n < c.nslot; n++, i = (i + 1) % c.nslot){
+    v = *idxslot(&c, i);
+    if(v == 0)
+      break;
+    if(v == DIRIDX_DEL || DIRIDX_TAG(v) != DIRIDX_TAG(h))
+      continue;
+    off = DIRIDX_ENT(v) * sizeof(struct dirent);
     bp = bread(dp->dev, bmap(dp, off / BSIZE));
-    for(de = (struct dirent*)bp->data;
-        de < (struct dirent*)(bp->data + BSIZE);
-        de++){
-      if(de->inum == 0)
+    de = (struct dirent*)(bp->data + off % BSIZE);
+    if(de->inum != 0 && namecmp(name, de->name) == 0){
+      *inum = de->inum;
+      *poff = off;
+      brelse(bp);
+      idxclose(&c);
+      return 1;
+    }
+    brelse(bp);
+  }
+  idxclose(&c);
+  return 0;
+}
+
+// Record in dp's index, if it has one, that name is now at off.
+// A directory that has grown to DIRHASHMIN blocks gets an index,
+// unless it has grown too big for one.
+static void
+idxinsert(struct inode *dp, char *name, uint off)
+{
+  struct idxcur c;
+  int r;
+
+  if(!idxopen(dp, &c)){
+    if(dp->size >= DIRHASHMIN*BSIZE)
+      idxbuild(dp);
+    return;
+  }
+  r = idxadd(&c, name, off);
+  iupdate(c.xp);
+  idxclose(&c);
+  if(r < 0)
+    idxbuild(dp);  // clears removed entries, or drops the index
+}
+
+// Remove the entry for the dirent at off from dp's index.
+static void
+idxremove(struct inode *dp, char *name, uint off)
+{
+  struct idxcur c;
+  uint h, i, n, *sp, want;
+
+  if(!idxopen(dp, &c))
+    return;
+  h = dirhash(name);
+  want = DIRIDX_TAG(h) | (off / sizeof(struct dirent) + 1);
+  for(n = 0, i = h % c.nslot; n < c.nslot; n++, i = (i + 1) % c.nslot){
+    sp = idxslot(&c, i);
+    if(*sp == 0)
+      break;
+    if(*sp == want){
+      *sp = DIRIDX_DEL;
+      log_write(c.bp);
+      break;
+    }
+  }
+  idxclose(&c);
+}
+
+// Find name in dp: in the name cache, in the hash index if dp has
+// one, or else by scanning dp, noting the answer in the name cache.
+// Return 1 and set *inum and *poff if name is there, 0 if not.
+// A scan also sets *pfree, if pfree is not 0, to the offset of
+// the first free entry it passed, or dp->size if it passed none;
+// otherwise *pfree is left alone.
+static int
+dirfind(struct inode *dp, char *name, uint *inum, uint *poff, uint *pfree)
+{
+  struct dirit it;
+  struct dirent *de;
+  int r;
+
+  if(dp->type != T_DIR)
+    panic("dirfind not DIR");
+
+  if((r = dcachelookup(dp->dev, dp->inum, name, inum, poff)) >= 0)
+    return r;
+  if((r = idxlookup(dp, name, inum, poff)) < 0){
+    if(pfree)
+      *pfree = dp->size;
+    for(dirstart(&it, dp, 0); (de = dirget(&it)) != 0; it.off += sizeof(*de)){
+      if(de->inum == 0){
+        if(pfree && *pfree == dp->size)
+          *pfree = it.off;
         continue;
+      }
       if(namecmp(name, de->name) == 0){
-        // entry matches path element
-        if(poff)
-          *poff = off + (uchar*)de - bp->data;
-        inum = de->inum;
-        brelse(bp);
-        return iget(dp->dev, inum);
+        *inum = de->inum;
+        *poff = it.off;
+        dirdone(&it);
+        break;
       }
     }
-    brelse(bp);
+    r = de != 0;
   }
-  return 0;
+  dcacheenter(dp->dev, dp->inum, name, r ? *inum : 0, r ? *poff : 0);
+  return r;
+}
+
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+// Caller must have already locked dp.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum, off;
+
+  if(!dirfind(dp, name, &inum, &off, 0))
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
-  struct inode *ip;
-
-  // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  uint off, free, ino;
+  struct dirit it;
+  struct dirent *de, d;
+
+  // Check that name is not present; a scan for it
+  // also finds a free entry.
+  free = ~0;
+  if(dirfind(dp, name, &ino, &off, &free))
     return -1;
-  }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
+  // Look for an empty dirent, if the scan did not.
+  if(free == ~0){
+    free = dp->size;
+    for(dirstart(&it, dp, dp->dirfree); (de = dirget(&it)) != 0; it.off += sizeof(*de)){
+      if(de->inum == 0){
+        free = it.off;
+        dirdone(&it);
+        break;
+      }
+    }
   }
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+  if(free < dp->size){
+    // Fill in the free entry in place.
+    dirstart(&it, dp, free);
+    de = dirget(&it);
+    strncpy(de->name, name, DIRSIZ);
+    de->inum = inum;
+    dirmod(&it);
+    dirdone(&it);
+  } else {
+    strncpy(d.name, name, DIRSIZ);
+    d.inum = inum;
+    if(writei(dp, (char*)&d, free, sizeof(d)) != sizeof(d))
+      panic("dirlink");
+  }
+  dp->dirfree = free + sizeof(*de);
+  dcacheenter(dp->dev, dp->inum, name, inum, free);
+  idxinsert(dp, name, free);
   
   return 0;
 }
 
+// Is the directory dp empty except for "." and ".." ?
+// Caller must have locked dp.
+int
+isdirempty(struct inode *dp)
+{
+  struct dirit it;
+  struct dirent *de;
+
+  for(dirstart(&it, dp, 2*sizeof(*de)); (de = dirget(&it)) != 0; it.off += sizeof(*de)){
+    if(de->inum != 0){
+      dirdone(&it);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Remove the directory entry for name, at offset off, from dp.
+// Caller must have locked dp.
+void
+dirunlink(struct inode *dp, char *name, uint off)
+{
+  struct dirit it;
+  struct dirent *de;
+
+  dirstart(&it, dp, off);
+  if((de = dirget(&it)) == 0)
+    panic("dirunlink: off");
+  memset(de, 0, sizeof(*de));
+  dirmod(&it);
+  dirdone(&it);
+  if(off < dp->dirfree)
+    dp->dirfree = off;
+  dcacheenter(dp->dev, dp->inum, name, 0, 0);
+  idxremove(dp, name, off);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -644,7 +1751,7 @@ namex(char *path, int nameiparent, char *name)
   struct inode *ip, *next;
 
   if(*path == '/')
-    ip = iget(ROOTDEV, ROOTINO);
+    ip = iget(rootdev, ROOTINO);
   else
     ip = idup(proc->cwd);
 
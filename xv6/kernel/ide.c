@@ -1,4 +1,17 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code for the primary channel.
+// If ideinit finds a PCI bus-master IDE controller, the disk
+// moves data to and from memory itself (DMA); otherwise the
+// CPU copies it with insl/outsl (PIO).
+// Requests for consecutive sectors are merged into one
+// READ/WRITE DMA or READ/WRITE MULTIPLE command.
+//
+// Requests are serviced in C-SCAN order: the disk sweeps
+// upward through the sectors, and requests behind the current
+// position wait for the next sweep, which starts again from
+// the lowest sector.  So that a steady stream of requests
+// ahead of the disk cannot starve the others, a sweep that
+// has run IDEDEADLINE ticks restarts at the oldest request
+// if that request has itself waited IDEDEADLINE ticks.
 
 #include "types.h"
 #include "defs.h"
@@ -9,6 +22,8 @@
 #include "traps.h"
 #include "spinlock.h"
 #include "buf.h"
+#include "kstat.h"
+#include "pci.h"
 
 #define IDE_BSY       0x80
 #define IDE_DRDY      0x40
@@ -17,16 +32,58 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
+#define IDE_CMD_RDMUL 0xc4
+#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus master IDE registers for the primary channel, from idebm
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// Physical region descriptor: one contiguous piece of
+// memory for a DMA transfer.  The table may not cross
+// a 64K boundary.
+struct prd {
+  uint addr;
+  ushort n;       // bytes
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry in table
+
+#define IDEDEADLINE 50  // ticks a request may wait before it jumps the sweep
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// The request being processed may cover idenbuf bufs for
+// consecutive sectors, starting at idequeue.
+// idequeue holds the current sweep and idenext the next one,
+// both sorted by (dev, sector).
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
-static struct buf *idequeue;
+static struct buf *idequeue, *idetail;
+static struct buf *idenext, *idenexttail;
+static int idenbuf;
+static uint idedev, idepos;  // last sector of the request in progress
+static uint idesweep;        // ticks when the current sweep started
+static struct idestat idest;
+static int ideanywait;       // processes sleeping in idewaitany on several bufs
 
 static int havedisk1;
+static int idemaxsect[2];  // sectors per READ/WRITE MULTIPLE, per disk
+static ushort idebm;       // bus master registers; 0 means use PIO
+static struct prd ideprd[IDEMAXSECT] __attribute__((aligned(128)));
 static void idestart(struct buf*);
+static void idenextreq(void);
+static struct buf *idelast(struct buf*);
 
 // Wait for IDE disk to become ready.
 static int
@@ -41,6 +98,44 @@ idewait(int checkerr)
   return 0;
 }
 
+// Look for a PCI IDE controller that can do bus-master DMA on
+// the primary channel at the legacy ports.  Return 0 if found.
+static int
+idedmainit(void)
+{
+  struct pcidev pd;
+
+  if(!IDEDMA || pcifindclass(0x01, 0x01, &pd) < 0)
+    return -1;
+  // prog if bit 0: primary channel not at 0x1f0 (native mode);
+  // bit 7: bus mastering supported.
+  if((pd.progif & 0x01) || !(pd.progif & 0x80))
+    return -1;
+  if(!(pd.bar[4] & 1))
+    return -1;
+  pcienable(&pd);
+  idebm = pd.bar[4] & ~3;
+  outb(idebm + BM_CMD, 0);
+  outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+  return 0;
+}
+
+// Set the number of sectors the disk transfers per interrupt
+// in READ/WRITE MULTIPLE.  If it refuses, use one sector at a time.
+static void
+idesetmultiple(int disk)
+{
+  idemaxsect[disk] = 1;
+  if(IDEMAXSECT <= 1)
+    return;
+  outb(0x3f6, 2);  // no interrupt for this command
+  outb(0x1f6, 0xe0 | (disk<<4));
+  outb(0x1f2, IDEMAXSECT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  if(idewait(1) >= 0)
+    idemaxsect[disk] = IDEMAXSECT;
+}
+
 void
 ideinit(void)
 {
@@ -59,30 +154,123 @@ ideinit(void)
       break;
     }
   }
+
+  if(idedmainit() == 0){
+    // DMA moves a whole request per interrupt.
+    idemaxsect[0] = idemaxsect[1] = IDEMAXSECT;
+  } else {
+    idesetmultiple(0);
+    if(havedisk1)
+      idesetmultiple(1);
+  }
   
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Give up on DMA after an error and use PIO from now on.
+// Caller must hold idelock.
+static void
+idepio(void)
+{
+  idebm = 0;
+  idesetmultiple(0);
+  if(havedisk1)
+    idesetmultiple(1);
+  outb(0x1f6, 0xe0 | (0<<4));
+}
+
+// Does a sort before b in sweep order?
+static int
+idebefore(struct buf *a, struct buf *b)
+{
+  if(a->dev != b->dev)
+    return a->dev < b->dev;
+  return a->sector < b->sector;
+}
+
+// Move queued requests for the sectors following b's up behind b,
+// so that one command can transfer them all.  Caller must hold idelock.
+// Returns the number of bufs in the request, including b.
+static int
+idemerge(struct buf *b)
+{
+  struct buf *last, **pp;
+  int n, write;
+
+  write = b->flags & B_DIRTY;
+  last = b;
+  for(n = 1; n < idemaxsect[b->dev&1]; n++){
+    for(pp = &last->qnext; *pp; pp = &(*pp)->qnext)
+      if((*pp)->dev == b->dev && (*pp)->sector == last->sector + 1 &&
+         ((*pp)->flags & B_DIRTY) == write)
+        break;
+    if(*pp == 0)
+      break;
+    if(pp != &last->qnext){
+      // Unlink it and put it right after last.
+      struct buf *nb = *pp;
+      *pp = nb->qnext;
+      nb->qnext = last->qnext;
+      last->qnext = nb;
+      if(nb == idetail)
+        idetail = idelast(idequeue);
+    }
+    last = last->qnext;
+  }
+  return n;
+}
+
+// Start the request for b, and for any queued requests
+// for the sectors right after it.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *p;
+  int i, write;
+
   if(b == 0)
     panic("idestart");
 
+  idenbuf = idemerge(b);
+  for(p = b, i = 1; i < idenbuf; i++)
+    p = p->qnext;
+  idest.ncmd++;
+  idest.seek += b->dev != idedev ? 0 :
+    b->sector > idepos ? b->sector - idepos : idepos - b->sector;
+  idedev = b->dev;
+  idepos = p->sector;
+
+  write = b->flags & B_DIRTY;
+  if(idebm){
+    // Point the controller at the bufs' data.
+    for(i = 0, p = b; i < idenbuf; i++, p = p->qnext){
+      ideprd[i].addr = (uint)p->data;
+      ideprd[i].n = 512;
+      ideprd[i].flags = 0;
+    }
+    ideprd[idenbuf-1].flags = PRD_EOT;
+    outl(idebm + BM_PRDT, (uint)ideprd);
+    outb(idebm + BM_CMD, write ? 0 : BM_CMD_READ);
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, 1);  // number of sectors
+  outb(0x1f2, idenbuf);  // number of sectors
   outb(0x1f3, b->sector & 0xff);
   outb(0x1f4, (b->sector >> 8) & 0xff);
   outb(0x1f5, (b->sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((b->sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, IDE_CMD_WRITE);
-    outsl(0x1f0, b->data, 512/4);
+  if(idebm){
+    outb(0x1f7, write ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, (write ? 0 : BM_CMD_READ) | BM_CMD_START);
+  } else if(write){
+    outb(0x1f7, idenbuf > 1 ? IDE_CMD_WRMUL : IDE_CMD_WRITE);
+    for(i = 0, p = b; i < idenbuf; i++, p = p->qnext)
+      outsl(0x1f0, p->data, 512/4);
   } else {
-    outb(0x1f7, IDE_CMD_READ);
+    outb(0x1f7, idenbuf > 1 ? IDE_CMD_RDMUL : IDE_CMD_READ);
   }
 }
 
@@ -90,41 +278,168 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
+  int i, ok, st;
 
-  // Take first buffer off queue.
+  // Take the finished request's bufs off queue.
   acquire(&idelock);
   if((b = idequeue) == 0){
     release(&idelock);
     // cprintf("spurious IDE interrupt\n");
     return;
   }
-  idequeue = b->qnext;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, 512/4);
-  
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  if(idebm){
+    // The controller has already moved it; stop it.
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    if(idewait(1) < 0 || (st & BM_ST_ERR)){
+      // The data may be incomplete: issue the request
+      // again without DMA, which the disk then never uses.
+      cprintf("ide: dma error on sector %d, using pio\n", b->sector);
+      idepio();
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+    ok = 0;
+  } else
+    ok = !(b->flags & B_DIRTY) && idewait(1) >= 0;
+
+  for(i = 0; i < idenbuf; i++, b = next){
+    next = b->qnext;
+    if(ok)
+      insl(0x1f0, b->data, 512/4);
+
+    // Wake process waiting for this buf,
+    // or release it if no one is waiting.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(ticks - b->qtime > idest.maxwait)
+      idest.maxwait = ticks - b->qtime;
+    idest.depth--;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      brelse(b);
+    } else
+      wakeup(b);
+  }
+  idequeue = b;
+  if(ideanywait)
+    wakeup(&ideanywait);
   
   // Start disk on next buf in queue.
+  idenextreq();
   if(idequeue != 0)
     idestart(idequeue);
 
   release(&idelock);
 }
 
-// Sync buf with disk. 
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Insert b into the sorted list *head with tail *tail.
+// Requests mostly arrive in ascending order, so try the tail first.
+static void
+ideinsert(struct buf **head, struct buf **tail, struct buf *b)
 {
   struct buf **pp;
 
+  if(*head == 0 || !idebefore(b, *tail)){
+    b->qnext = 0;
+    if(*head == 0)
+      *head = b;
+    else
+      (*tail)->qnext = b;
+    *tail = b;
+    return;
+  }
+  for(pp = head; !idebefore(b, *pp); pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Merge the sorted lists a and b into one sorted list.
+static struct buf*
+idemergelists(struct buf *a, struct buf *b)
+{
+  struct buf *head, **pp;
+
+  pp = &head;
+  while(a && b){
+    if(idebefore(b, a)){
+      *pp = b;
+      b = b->qnext;
+    } else {
+      *pp = a;
+      a = a->qnext;
+    }
+    pp = &(*pp)->qnext;
+  }
+  *pp = a ? a : b;
+  return head;
+}
+
+// Return the last buf of list l.
+static struct buf*
+idelast(struct buf *l)
+{
+  if(l)
+    while(l->qnext)
+      l = l->qnext;
+  return l;
+}
+
+// Choose the request to service after the one that just
+// finished, which has been removed from idequeue.
+static void
+idenextreq(void)
+{
+  struct buf *b, *old, *all, **pp;
+
+  if(idequeue == 0){
+    // End of sweep: go back to the lowest sector.
+    if(idenext == 0)
+      return;
+    idequeue = idenext;
+    idetail = idenexttail;
+    idenext = idenexttail = 0;
+    idesweep = ticks;
+    idest.nsweep++;
+    return;
+  }
+  if(ticks - idesweep < IDEDEADLINE)
+    return;
+
+  // The sweep has run long.  If some request has waited
+  // too long, restart the sweep at the oldest one.
+  old = idequeue;
+  for(b = idequeue; b; b = b->qnext)
+    if(b->qtime < old->qtime)
+      old = b;
+  for(b = idenext; b; b = b->qnext)
+    if(b->qtime < old->qtime)
+      old = b;
+  idesweep = ticks;
+  if(ticks - old->qtime < IDEDEADLINE || old == idequeue)
+    return;
+  all = idemergelists(idequeue, idenext);
+  for(pp = &all; *pp != old; pp = &(*pp)->qnext)
+    ;
+  *pp = 0;
+  idequeue = old;
+  idetail = idelast(old);
+  idenext = all;
+  idenexttail = idelast(all);
+  idest.nexpired++;
+}
+
+// Add b to the queue and start the disk if it is idle.
+// Caller must hold idelock.
+static void
+ideenqueue(struct buf *b)
+{
   if(!(b->flags & B_BUSY))
     panic("iderw: buf not busy");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -132,17 +447,69 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);
+  b->qtime = ticks;
+  idest.nreq++;
+  if(++idest.depth > idest.maxdepth)
+    idest.maxdepth = idest.depth;
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)
-    ;
-  *pp = b;
-  
-  // Start disk if necessary.
-  if(idequeue == b)
+  if(idequeue == 0){
+    // Disk is idle.
+    b->qnext = 0;
+    idequeue = idetail = b;
+    idesweep = ticks;
     idestart(b);
+  } else if(ticks - idesweep < IDEDEADLINE &&
+            (b->dev > idedev || (b->dev == idedev && b->sector > idepos))){
+    // Ahead of the disk: this sweep.
+    ideinsert(&idequeue, &idetail, b);
+  } else
+    ideinsert(&idenext, &idenexttail, b);
+}
+
+// Start syncing buf with disk, but do not wait for it.
+// If B_ASYNC is set, ideintr releases buf when done;
+// otherwise the caller must wait with idewaitany.
+void
+idesubmit(struct buf *b)
+{
+  acquire(&idelock);
+  ideenqueue(b);
+  release(&idelock);
+}
+
+// Wait until the I/O idesubmit started on at least one
+// of the n bufs in bp is done, and return its index.
+int
+idewaitany(struct buf **bp, int n)
+{
+  int i;
+
+  acquire(&idelock);
+  for(;;){
+    for(i = 0; i < n; i++){
+      if((bp[i]->flags & (B_VALID|B_DIRTY)) == B_VALID){
+        release(&idelock);
+        return i;
+      }
+    }
+    if(n == 1)
+      sleep(bp[0], &idelock);
+    else {
+      ideanywait++;
+      sleep(&ideanywait, &idelock);
+      ideanywait--;
+    }
+  }
+}
+
+// Sync buf with disk. 
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);
+  ideenqueue(b);
   
   // Wait for request to finish.
   // Assuming will not sleep too long: ignore proc->killed.
@@ -152,3 +519,12 @@ iderw(struct buf *b)
 
   release(&idelock);
 }
+
+// Report disk queue statistics.
+void
+idestat(struct idestat *st)
+{
+  acquire(&idelock);
+  *st = idest;
+  release(&idelock);
+}
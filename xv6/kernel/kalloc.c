@@ -15,6 +15,7 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;  // number of pages on freelist
 } kmem;
 
 extern char end[]; // first address after kernel loaded from ELF file
@@ -50,22 +51,37 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   release(&kmem.lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// When the freelist is empty, asks the buffer cache
+// to give back idle pages before giving up.
 char*
 kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
-  return (char*)r;
+  for(;;){
+    acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+    }
+    release(&kmem.lock);
+    if(r || !bshrink())
+      return (char*)r;
+  }
+}
+
+// Number of free pages.
+int
+kfreepages(void)
+{
+  return kmem.nfree;
 }
 
@@ -0,0 +1,313 @@
+// File system log.
+//
+// Every file system system call is an operation: it calls
+// begin_op first and end_op when done, and in between writes
+// blocks with log_write instead of bwrite.  log_write only notes
+// the block in the in-memory log header and pins its buffer in
+// the cache, so nothing reaches its home on disk yet.
+//
+// Operations are grouped into transactions.  The log commits
+// when no operation is in progress and someone asks it to: an
+// operation that might not fit in what is left of the log, sync
+// or fsync, or bflushd every BFLUSHTICKS.  So a commit usually
+// writes the blocks of many operations, and a block changed by
+// several of them is written once.  A commit writes the blocks
+// to the log, then the header, which is the commit point; then
+// installs them at home and clears the header.  After a crash,
+// logrecover installs a committed transaction again and the
+// file system is as it was after the last commit.
+//
+// Each operation may write at most MAXOPBLOCKS distinct blocks,
+// and begin_op waits until the log has room for that many more
+// from every operation in progress.
+//
+// The on-disk format is described with struct logheader in fs.h.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "buf.h"
+#include "fs.h"
+#include "kstat.h"
+
+#define LOGBATCH 16  // log writes in flight at once
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;       // first header block
+  int outstanding;  // operations in progress
+  int committing;   // in commit, or not yet recovered
+  int flushreq;     // commit once outstanding operations end
+  uint ncommit;     // commits so far
+  uint nops;        // operations since the last commit
+  struct logheader lh;
+  struct logstat stat;
+} log;
+
+// Read the log header from disk into the in-memory log header.
+static void
+readhead(void)
+{
+  struct buf *bp;
+  uint i, n;
+
+  for(i = 0; i < LOGHDR; i++){
+    bp = bread(log.dev, log.start + i);
+    n = sizeof(log.lh) - i*BSIZE;
+    memmove((char*)&log.lh + i*BSIZE, bp->data, n < BSIZE ? n : BSIZE);
+    brelse(bp);
+  }
+  if(log.lh.n > LOGSIZE)
+    panic("readhead: bad log");
+}
+
+// Write the in-memory log header to disk: only the blocks that
+// hold its first lh.n entries, and the block holding n last.
+static void
+writehead(void)
+{
+  struct buf *bp;
+  int i;
+  uint n;
+
+  for(i = (sizeof(uint) * (log.lh.n + 1) - 1) / BSIZE; i >= 0; i--){
+    bp = bread(log.dev, log.start + i);
+    n = sizeof(log.lh) - i*BSIZE;
+    memmove(bp->data, (char*)&log.lh + i*BSIZE, n < BSIZE ? n : BSIZE);
+    bwrite(bp);
+    brelse(bp);
+  }
+}
+
+// Copy the blocks in the log header from the cache to the log,
+// LOGBATCH at a time.
+static void
+writelog(void)
+{
+  struct buf *from, *to[LOGBATCH];
+  uint i, j, n;
+
+  for(i = 0; i < log.lh.n; i += n){
+    n = 0;
+    for(j = i; j < log.lh.n && n < LOGBATCH; j++){
+      from = bread(log.dev, log.lh.block[j]);
+      to[n] = bclaim(log.dev, log.start + LOGHDR + j);
+      memmove(to[n]->data, from->data, BSIZE);
+      bwrite_async(to[n++]);
+      brelse(from);
+    }
+    for(j = 0; j < n; j++){
+      bwait(to[j]);
+      brelse(to[j]);
+    }
+  }
+}
+
+// Write the cached blocks in the log header to their homes,
+// LOGBATCH at a time, and unpin them.
+static void
+installtrans(void)
+{
+  struct buf *bp[LOGBATCH];
+  uint i, j, n;
+
+  for(i = 0; i < log.lh.n; i += n){
+    n = 0;
+    for(j = i; j < log.lh.n && n < LOGBATCH; j++){
+      bp[n] = bread(log.dev, log.lh.block[j]);
+      bwrite_async(bp[n++]);
+    }
+    for(j = 0; j < n; j++){
+      bwait(bp[j]);
+      bp[j]->flags &= ~B_PIN;
+      brelse(bp[j]);
+    }
+  }
+}
+
+static void
+commit(void)
+{
+  if(log.lh.n == 0)
+    return;
+  writelog();
+  writehead();    // the commit point
+  installtrans();
+  log.lh.n = 0;
+  writehead();    // forget the transaction
+}
+
+// Commit the log.  Caller holds log.lock and no operation is
+// in progress; the lock is dropped while the commit runs.
+static void
+docommit(void)
+{
+  log.committing = 1;
+  log.flushreq = 0;
+  log.stat.commits++;
+  log.stat.blocks += log.lh.n;
+  if(log.nops > log.stat.maxops)
+    log.stat.maxops = log.nops;
+  log.nops = 0;
+  release(&log.lock);
+
+  commit();
+
+  acquire(&log.lock);
+  log.committing = 0;
+  log.ncommit++;
+  wakeup(&log);
+}
+
+// Hold off operations until logrecover has run.
+void
+loginit(void)
+{
+  initlock(&log.lock, "log");
+  log.committing = 1;
+}
+
+// Find the log on dev, which holds the root file system, and
+// install any transaction committed there before a crash.
+// Must run in a process, before any file system operation.
+void
+logrecover(uint dev)
+{
+  struct superblock sb;
+  struct buf *bp, *lbp;
+  uint i;
+
+  bp = bread(dev, 1);
+  memmove(&sb, bp->data, sizeof(sb));
+  brelse(bp);
+  if(sb.nlog < NLOG || sb.logstart + sb.nlog > sb.size)
+    panic("logrecover: no log");
+  log.dev = dev;
+  log.start = sb.logstart;
+
+  readhead();
+  if(log.lh.n > 0){
+    cprintf("log: recovering %d blocks\n", log.lh.n);
+    for(i = 0; i < log.lh.n; i++){
+      lbp = bread(dev, log.start + LOGHDR + i);
+      bp = bclaim(dev, log.lh.block[i]);
+      memmove(bp->data, lbp->data, BSIZE);
+      bwrite(bp);
+      brelse(lbp);
+      brelse(bp);
+    }
+    log.lh.n = 0;
+    writehead();
+  }
+
+  acquire(&log.lock);
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Called at the start of each file system operation.
+void
+begin_op(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(log.committing || log.flushreq){
+      sleep(&log, &log.lock);
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+      // This operation might run out of log space.  Wait for
+      // another to end, and if the log itself is filling up,
+      // have the last one commit; with none, commit now.
+      log.stat.waits++;
+      if(log.outstanding == 0)
+        docommit();
+      else {
+        if(log.lh.n + 2*MAXOPBLOCKS > LOGSIZE)
+          log.flushreq = 1;
+        sleep(&log, &log.lock);
+      }
+    } else {
+      log.outstanding++;
+      log.nops++;
+      log.stat.ops++;
+      break;
+    }
+  }
+  release(&log.lock);
+}
+
+// Called at the end of each file system operation.
+// Commits if this was the last operation and a commit is wanted.
+void
+end_op(void)
+{
+  acquire(&log.lock);
+  if(log.outstanding < 1 || log.committing)
+    panic("end_op");
+  log.outstanding--;
+  if(log.outstanding == 0 && log.flushreq)
+    docommit();
+  else
+    wakeup(&log);  // begin_op may be waiting for log space
+  release(&log.lock);
+}
+
+// Commit every operation that has ended, waiting for
+// operations in progress to end first.
+void
+log_flush(void)
+{
+  uint want;
+
+  acquire(&log.lock);
+  while(log.committing)
+    sleep(&log, &log.lock);
+  if(log.outstanding == 0){
+    if(log.lh.n > 0)
+      docommit();
+  } else {
+    want = log.ncommit + 1;
+    log.flushreq = 1;
+    while(log.ncommit < want)
+      sleep(&log, &log.lock);
+  }
+  release(&log.lock);
+}
+
+// Caller has modified b->data and is done with the buffer.
+// Record the block in the log and pin it in the cache until
+// the log commits.  Replaces bwrite; a typical use is:
+//   bp = bread(...)
+//   modify bp->data[]
+//   log_write(bp)
+//   brelse(bp)
+void
+log_write(struct buf *b)
+{
+  if((b->flags & B_BUSY) == 0 || b->dev != log.dev)
+    panic("log_write");
+  acquire(&log.lock);
+  if(log.outstanding < 1)
+    panic("log_write outside of op");
+  if(b->flags & B_PIN){
+    // Already in this transaction.
+    log.stat.absorbed++;
+  } else {
+    if(log.lh.n >= LOGSIZE)
+      panic("log_write: transaction too big");
+    log.lh.block[log.lh.n++] = b->sector;
+    b->flags |= B_PIN;
+  }
+  release(&log.lock);
+}
+
+void
+logstat(struct logstat *st)
+{
+  acquire(&log.lock);
+  *st = log.stat;
+  st->pending = log.lh.n;
+  release(&log.lock);
+}
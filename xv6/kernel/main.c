@@ -53,7 +53,11 @@ mainc(void)
   binit();         // buffer cache
   fileinit();      // file table
   iinit();         // inode cache
+  dcacheinit();    // directory name cache
+  loginit();       // file system log
   ideinit();       // disk
+  if(virtioinit() == 0)
+    rootdev = VIRTIODEV;  // virtio disk holds the file system
   if(!ismp)
     timerinit();   // uniprocessor timer
   bootothers();    // start other processors
@@ -62,6 +66,7 @@ mainc(void)
   cinit();
   sti();           // enable inturrupts
   userinit();      // first user process
+  kthread("bflushd", bflushd);  // buffer cache write-back
   scheduler();     // start running processes
 }
 
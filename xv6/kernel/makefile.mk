@@ -3,6 +3,7 @@
 KERNEL_OBJECTS := \
 	bio.o\
 	console.o\
+	dcache.o\
 	exec.o\
 	file.o\
 	fs.o\
@@ -11,8 +12,10 @@ KERNEL_OBJECTS := \
 	kalloc.o\
 	kbd.o\
 	lapic.o\
+	log.o\
 	main.o\
 	mp.o\
+	pci.o\
 	picirq.o\
 	pipe.o\
 	proc.o\
@@ -26,6 +29,7 @@ KERNEL_OBJECTS := \
 	trapasm.o\
 	trap.o\
 	uart.o\
+	virtio.o\
 	vectors.o\
 	vm.o\
 
@@ -0,0 +1,98 @@
+// PCI bus enumeration, using configuration mechanism #1.
+// Drivers look up their device by class or by vendor and
+// device id, then read its base address registers.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+uint
+pciconfread(struct pcidev *pd, int off)
+{
+  outl(PCI_CONFIG_ADDR, 0x80000000 | (pd->bus << 16) | (pd->dev << 11) |
+       (pd->func << 8) | (off & 0xfc));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void
+pciconfwrite(struct pcidev *pd, int off, uint v)
+{
+  outl(PCI_CONFIG_ADDR, 0x80000000 | (pd->bus << 16) | (pd->dev << 11) |
+       (pd->func << 8) | (off & 0xfc));
+  outl(PCI_CONFIG_DATA, v);
+}
+
+// Fill in pd from the configuration space of the function
+// pd->bus, pd->dev, pd->func.  Return 0 if there is one, -1 if not.
+static int
+pciread(struct pcidev *pd)
+{
+  uint id, class, i;
+
+  id = pciconfread(pd, PCI_ID);
+  if((id & 0xffff) == 0xffff)
+    return -1;
+  pd->vendor = id & 0xffff;
+  pd->device = id >> 16;
+  class = pciconfread(pd, PCI_CLASS);
+  pd->class = class >> 24;
+  pd->subclass = class >> 16;
+  pd->progif = class >> 8;
+  pd->irq = pciconfread(pd, PCI_INTR) & 0xff;
+  for(i = 0; i < 6; i++)
+    pd->bar[i] = pciconfread(pd, PCI_BAR0 + 4*i);
+  return 0;
+}
+
+// Find the first function on the bus for which match returns
+// non-zero, and describe it in pd.  Return 0 if found, -1 if not.
+static int
+pcifind(struct pcidev *pd, int (*match)(struct pcidev*, uint, uint),
+        uint a, uint b)
+{
+  for(pd->bus = 0; pd->bus < 256; pd->bus++)
+    for(pd->dev = 0; pd->dev < 32; pd->dev++)
+      for(pd->func = 0; pd->func < 8; pd->func++)
+        if(pciread(pd) == 0 && match(pd, a, b))
+          return 0;
+  return -1;
+}
+
+static int
+matchclass(struct pcidev *pd, uint class, uint subclass)
+{
+  return pd->class == class && pd->subclass == subclass;
+}
+
+static int
+matchid(struct pcidev *pd, uint vendor, uint device)
+{
+  return pd->vendor == vendor && pd->device == device;
+}
+
+// Find a function by class and subclass.
+int
+pcifindclass(int class, int subclass, struct pcidev *pd)
+{
+  return pcifind(pd, matchclass, class, subclass);
+}
+
+// Find a function by vendor and device id.
+int
+pcifindid(int vendor, int device, struct pcidev *pd)
+{
+  return pcifind(pd, matchid, vendor, device);
+}
+
+// Let the function respond to I/O and memory accesses
+// and act as a bus master.
+void
+pcienable(struct pcidev *pd)
+{
+  uint cmd;
+
+  cmd = pciconfread(pd, PCI_COMMAND) & 0xffff;
+  cmd |= PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER;
+  pciconfwrite(pd, PCI_COMMAND, cmd);
+}
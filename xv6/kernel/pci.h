@@ -0,0 +1,34 @@
+#ifndef _PCI_H_
+#define _PCI_H_
+// PCI configuration space
+
+#define PCI_CONFIG_ADDR 0xcf8   // configuration mechanism #1
+#define PCI_CONFIG_DATA 0xcfc
+
+// Configuration space header offsets
+#define PCI_ID          0x00    // device id << 16 | vendor id
+#define PCI_COMMAND     0x04    // status << 16 | command
+#define PCI_CLASS       0x08    // class, subclass, prog if, revision
+#define PCI_BAR0        0x10    // base address registers 0..5
+#define PCI_INTR        0x3c    // interrupt pin << 8 | line
+
+// Command register bits
+#define PCI_CMD_IO      0x1     // respond to I/O space accesses
+#define PCI_CMD_MEM     0x2     // respond to memory space accesses
+#define PCI_CMD_MASTER  0x4     // may act as bus master
+
+// One function of a PCI device
+struct pcidev {
+  int bus;
+  int dev;
+  int func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;            // interrupt line
+  uint bar[6];          // base address registers
+};
+
+#endif // _PCI_H_
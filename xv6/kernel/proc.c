@@ -101,6 +101,21 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel process running fn, which must never return.
+// It has no user memory and shares the kernel page table.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0 || (p->pgdir = setupkvm()) == 0)
+    panic("kthread");
+  // forkret returns into fn instead of trapret.
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -179,7 +194,9 @@ exit(void)
     }
   }
 
+  begin_op();
   iput(proc->cwd);
+  end_op();
   proc->cwd = 0;
 
   acquire(&ptable.lock);
@@ -320,8 +337,20 @@ yield(void)
 void
 forkret(void)
 {
+  static int first = 1;
+  int recover;
+
   // Still holding ptable.lock from scheduler.
+  recover = first;
+  first = 0;
   release(&ptable.lock);
+
+  if(recover){
+    // The log must be read from disk, which means sleeping,
+    // so it cannot be done in main.  File system operations
+    // in other processes wait in begin_op until it is done.
+    logrecover(rootdev);
+  }
   
   // Return to "caller", actually trapret (see allocproc).
 }
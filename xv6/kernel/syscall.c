@@ -103,6 +103,11 @@ static int (*syscalls[])(void) = {
 [SYS_wait]    sys_wait,
 [SYS_write]   sys_write,
 [SYS_uptime]  sys_uptime,
+[SYS_kstat]   sys_kstat,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
+[SYS_bcachectl] sys_bcachectl,
+[SYS_statfs]  sys_statfs,
 };
 
 // Called on a syscall trap. Checks that the syscall number (passed via eax)
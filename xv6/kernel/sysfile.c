@@ -106,6 +106,53 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Report the size and free space of the file system holding path.
+int
+sys_statfs(void)
+{
+  char *path;
+  struct statfs *st;
+  struct inode *ip;
+  uint dev;
+
+  if(argstr(0, &path) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  dev = ip->dev;
+  iput(ip);
+  end_op();
+  fsstat(dev, st);
+  return 0;
+}
+
+// Commit the log and write all dirty cached blocks to disk.
+int
+sys_sync(void)
+{
+  log_flush();
+  bflush(-1);
+  return 0;
+}
+
+// Write the file's data and metadata to disk.
+// The log does not track which blocks belong to which file,
+// so this commits every operation that has ended.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_flush();
+  bflush(f->ip->dev);
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -115,11 +162,16 @@ sys_link(void)
 
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
-  if((ip = namei(old)) == 0)
+
+  begin_op();
+  if((ip = namei(old)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type == T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   ip->nlink++;
@@ -135,6 +187,7 @@ sys_link(void)
   }
   iunlockput(dp);
   iput(ip);
+  end_op();
   return 0;
 
 bad:
@@ -142,62 +195,43 @@ bad:
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return -1;
 }
 
-// Is the directory dp empty except for "." and ".." ?
-static int
-isdirempty(struct inode *dp)
-{
-  int off;
-  struct dirent de;
-
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("isdirempty: readi");
-    if(de.inum != 0)
-      return 0;
-  }
-  return 1;
-}
-
 int
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], *path;
   uint off;
 
   if(argstr(0, &path) < 0)
     return -1;
-  if((dp = nameiparent(path, name)) == 0)
+
+  begin_op();
+  if((dp = nameiparent(path, name)) == 0){
+    end_op();
     return -1;
+  }
   ilock(dp);
 
   // Cannot unlink "." or "..".
-  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
-    iunlockput(dp);
-    return -1;
-  }
+  if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0)
+    goto bad;
 
-  if((ip = dirlookup(dp, name, &off)) == 0){
-    iunlockput(dp);
-    return -1;
-  }
+  if((ip = dirlookup(dp, name, &off)) == 0)
+    goto bad;
   ilock(ip);
 
   if(ip->nlink < 1)
     panic("unlink: nlink < 1");
   if(ip->type == T_DIR && !isdirempty(ip)){
     iunlockput(ip);
-    iunlockput(dp);
-    return -1;
+    goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("unlink: writei");
+  dirunlink(dp, name, off);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -207,7 +241,13 @@ sys_unlink(void)
   ip->nlink--;
   iupdate(ip);
   iunlockput(ip);
+  end_op();
   return 0;
+
+bad:
+  iunlockput(dp);
+  end_op();
+  return -1;
 }
 
 static struct inode*
@@ -225,12 +265,11 @@ create(char *path, short type, short major, short minor)
     iunlockput(dp);
     ilock(ip);
 	
-    if(type == T_FILE && ip->type == T_FILE)
+    if(type == T_FILE && (ip->type == T_FILE || ip->type == T_SMALLFILE))
       return ip;
-    
-	if(type == T_SMALLFILE && ip->type == T_SMALLFILE) {
+
+    if(type == T_EXTENT && ip->type == T_EXTENT)
       return ip;
-	}
   
     iunlockput(ip);
     return 0;
@@ -270,33 +309,49 @@ sys_open(void)
 
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
+
+  begin_op();
   if(omode & O_CREATE){
-	  
-	if(omode & O_SMALLFILE) {
-	  if((ip = create(path, T_SMALLFILE, 0, 0)) == 0)
-        return -1;  
+	// Every file starts out inline now, so O_SMALLFILE
+	// asks for nothing more than a plain file.
+	if(omode & O_EXTENT) {
+      if((ip = create(path, T_EXTENT, 0, 0)) == 0){
+        end_op();
+        return -1;
+      }
 	} else {
-      if((ip = create(path, T_FILE, 0, 0)) == 0)
+      if((ip = create(path, T_FILE, 0, 0)) == 0){
+        end_op();
         return -1;
+      }
 	}
 	
   } else {
-    if((ip = namei(path)) == 0)
+    if((ip = namei(path)) == 0){
+      end_op();
       return -1;
+    }
     ilock(ip);
     if(ip->type == T_DIR && omode != O_RDONLY){
       iunlockput(ip);
+      end_op();
       return -1;
     }
   }
 
+  if((omode & O_TRUNC) && (omode & (O_WRONLY|O_RDWR)) &&
+     (ip->type == T_FILE || ip->type == T_SMALLFILE || ip->type == T_EXTENT))
+    itrunc(ip);
+
   if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
     if(f)
       fileclose(f);
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
+  end_op();
 
   f->type = FD_INODE;
   f->ip = ip;
@@ -312,9 +367,13 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -326,12 +385,16 @@ sys_mknod(void)
   int len;
   int major, minor;
   
+  begin_op();
   if((len=argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
-     (ip = create(path, T_DEV, major, minor)) == 0)
+     (ip = create(path, T_DEV, major, minor)) == 0){
+    end_op();
     return -1;
+  }
   iunlockput(ip);
+  end_op();
   return 0;
 }
 
@@ -341,15 +404,20 @@ sys_chdir(void)
   char *path;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0)
+  begin_op();
+  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+    end_op();
     return -1;
+  }
   ilock(ip);
   if(ip->type != T_DIR){
     iunlockput(ip);
+    end_op();
     return -1;
   }
   iunlock(ip);
   iput(proc->cwd);
+  end_op();
   proc->cwd = ip;
   return 0;
 }
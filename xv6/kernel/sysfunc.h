@@ -23,5 +23,10 @@ int sys_unlink(void);
 int sys_wait(void);
 int sys_write(void);
 int sys_uptime(void);
+int sys_kstat(void);
+int sys_sync(void);
+int sys_fsync(void);
+int sys_bcachectl(void);
+int sys_statfs(void);
 
 #endif // _SYSFUNC_H_
@@ -5,6 +5,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "sysfunc.h"
+#include "kstat.h"
 
 int
 sys_fork(void)
@@ -88,3 +89,60 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Copy kernel statistics of the given kind into a user buffer,
+// which must be exactly the size of the matching struct.
+int
+sys_kstat(void)
+{
+  int kind, n;
+  char *p;
+
+  if(argint(0, &kind) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    return -1;
+  switch(kind){
+  case KSTAT_BCACHE:
+    if(n != sizeof(struct bcachestat))
+      return -1;
+    bstat((struct bcachestat*)p);
+    return 0;
+  case KSTAT_BIO:
+    if(n != sizeof(struct biostat))
+      return -1;
+    biostat((struct biostat*)p);
+    return 0;
+  case KSTAT_IDE:
+    if(n != sizeof(struct idestat))
+      return -1;
+    idestat((struct idestat*)p);
+    return 0;
+  case KSTAT_DCACHE:
+    if(n != sizeof(struct dcachestat))
+      return -1;
+    dcachestat((struct dcachestat*)p);
+    return 0;
+  case KSTAT_LOG:
+    if(n != sizeof(struct logstat))
+      return -1;
+    logstat((struct logstat*)p);
+    return 0;
+  }
+  return -1;
+}
+
+// Tune the buffer cache.
+int
+sys_bcachectl(void)
+{
+  int op, arg;
+
+  if(argint(0, &op) < 0 || argint(1, &arg) < 0)
+    return -1;
+  switch(op){
+  case BCTL_POLICY:
+    return bsetpolicy(arg);
+  case BCTL_MAXBUF:
+    return bsetmax(arg);
+  }
+  return -1;
+}
@@ -0,0 +1,267 @@
+// Driver for a virtio block device, legacy PCI interface.
+//
+// The device has a single virtqueue.  Each request is a chain
+// of three descriptors: the request header, the buf's data, and
+// a status byte the device fills in.  Requests are independent,
+// so as many as the queue has room for can be in flight at once.
+// Like ide.c, the driver sets B_VALID and clears B_DIRTY when a
+// request finishes, then releases the buf if B_ASYNC is set and
+// wakes up its waiter otherwise.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define VQMAX 256  // largest queue that vqmem holds
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;
+  uint qsz;
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  struct vring_used *used;
+  ushort usedidx;      // next used entry to look at
+  uchar free[VQMAX];   // is descriptor free?
+  uint nfree;
+  int anywait;         // processes sleeping in virtiowaitany on several bufs
+
+  // For each request, indexed by its first descriptor.
+  struct {
+    struct buf *b;
+    struct virtio_blk_req hdr;
+    uchar status;
+  } info[VQMAX];
+} vblk;
+
+// Ring memory: descriptors and available ring, then the used
+// ring on the next page boundary.
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+int virtioirq = -1;  // interrupt line of the disk, if any
+
+// Find and set up the disk.  Return 0 if there is one.
+int
+virtioinit(void)
+{
+  struct pcidev pd;
+  ushort io;
+  uint i, usedoff;
+
+  if(pcifindid(VIRTIO_VENDOR, VIRTIO_DEV_BLK, &pd) < 0 || !(pd.bar[0] & 1))
+    return -1;
+  initlock(&vblk.lock, "virtio");
+  pcienable(&pd);
+  io = vblk.iobase = pd.bar[0] & ~3;
+
+  outb(io + VIRTIO_STATUS, 0);  // reset
+  outb(io + VIRTIO_STATUS, VIRTIO_ST_ACK);
+  outb(io + VIRTIO_STATUS, VIRTIO_ST_ACK|VIRTIO_ST_DRIVER);
+  outl(io + VIRTIO_GUEST_FEATURES, 0);
+
+  outw(io + VIRTIO_QUEUE_SEL, 0);
+  vblk.qsz = inw(io + VIRTIO_QUEUE_SIZE);
+  usedoff = PGROUNDUP(vblk.qsz*sizeof(struct vring_desc) +
+                      sizeof(struct vring_avail) + vblk.qsz*sizeof(ushort));
+  if(vblk.qsz < 3 || vblk.qsz > VQMAX || usedoff +
+     sizeof(struct vring_used) + vblk.qsz*sizeof(struct vring_used_elem) >
+     sizeof(vqmem)){
+    cprintf("virtio: unusable queue size %d\n", vblk.qsz);
+    outb(io + VIRTIO_STATUS, VIRTIO_ST_FAILED);
+    return -1;
+  }
+  memset(vqmem, 0, sizeof(vqmem));
+  vblk.desc = (struct vring_desc*)vqmem;
+  vblk.avail = (struct vring_avail*)(vqmem + vblk.qsz*sizeof(struct vring_desc));
+  vblk.used = (struct vring_used*)(vqmem + usedoff);
+  for(i = 0; i < vblk.qsz; i++)
+    vblk.free[i] = 1;
+  vblk.nfree = vblk.qsz;
+  outl(io + VIRTIO_QUEUE_PFN, (uint)vqmem >> 12);
+
+  virtioirq = pd.irq;
+  picenable(virtioirq);
+  ioapicenable(virtioirq, ncpu - 1);
+  outb(io + VIRTIO_STATUS, VIRTIO_ST_ACK|VIRTIO_ST_DRIVER|VIRTIO_ST_DRIVER_OK);
+  return 0;
+}
+
+// Take a free descriptor.  Caller must hold vblk.lock
+// and have checked that there is one.
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vblk.qsz; i++){
+    if(vblk.free[i]){
+      vblk.free[i] = 0;
+      vblk.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: no free desc");
+}
+
+// Free the chain of descriptors starting at i.
+static void
+freechain(int i)
+{
+  for(;;){
+    vblk.free[i] = 1;
+    vblk.nfree++;
+    if(!(vblk.desc[i].flags & VRING_DESC_NEXT))
+      break;
+    i = vblk.desc[i].next;
+  }
+  wakeup(&vblk.nfree);
+}
+
+// Hand b to the device.  Caller must hold vblk.lock.
+static void
+virtioenqueue(struct buf *b)
+{
+  struct vring_desc *d;
+  int id[3], write;
+
+  if(!(b->flags & B_BUSY))
+    panic("virtiorw: buf not busy");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+
+  while(vblk.nfree < 3)
+    sleep(&vblk.nfree, &vblk.lock);
+  id[0] = allocdesc();
+  id[1] = allocdesc();
+  id[2] = allocdesc();
+
+  write = b->flags & B_DIRTY;
+  vblk.info[id[0]].b = b;
+  vblk.info[id[0]].hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vblk.info[id[0]].hdr.reserved = 0;
+  vblk.info[id[0]].hdr.sector = b->sector;
+  vblk.info[id[0]].hdr.sectorhi = 0;
+  vblk.info[id[0]].status = 0xff;
+
+  d = &vblk.desc[id[0]];
+  d->addr = (uint)&vblk.info[id[0]].hdr;
+  d->addrhi = 0;
+  d->len = sizeof(struct virtio_blk_req);
+  d->flags = VRING_DESC_NEXT;
+  d->next = id[1];
+
+  d = &vblk.desc[id[1]];
+  d->addr = (uint)b->data;
+  d->addrhi = 0;
+  d->len = 512;
+  d->flags = VRING_DESC_NEXT | (write ? 0 : VRING_DESC_WRITE);
+  d->next = id[2];
+
+  d = &vblk.desc[id[2]];
+  d->addr = (uint)&vblk.info[id[0]].status;
+  d->addrhi = 0;
+  d->len = 1;
+  d->flags = VRING_DESC_WRITE;
+  d->next = 0;
+
+  // The device must see the descriptors before the ring entry,
+  // and the ring entry before the new index.
+  vblk.avail->ring[vblk.avail->idx % vblk.qsz] = id[0];
+  __sync_synchronize();
+  vblk.avail->idx++;
+  __sync_synchronize();
+  outw(vblk.iobase + VIRTIO_QUEUE_NOTIFY, 0);
+}
+
+// Interrupt handler.
+void
+virtiointr(void)
+{
+  struct vring_used_elem *e;
+  struct buf *b;
+
+  acquire(&vblk.lock);
+  inb(vblk.iobase + VIRTIO_ISR);  // acknowledge
+
+  while(vblk.usedidx != vblk.used->idx){
+    __sync_synchronize();
+    e = &vblk.used->ring[vblk.usedidx % vblk.qsz];
+    b = vblk.info[e->id].b;
+    if(vblk.info[e->id].status != 0)
+      cprintf("virtio: error %d on sector %d\n",
+              vblk.info[e->id].status, b->sector);
+    vblk.info[e->id].b = 0;
+    freechain(e->id);
+    vblk.usedidx++;
+
+    // Wake process waiting for this buf,
+    // or release it if no one is waiting.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      brelse(b);
+    } else
+      wakeup(b);
+  }
+  if(vblk.anywait)
+    wakeup(&vblk.anywait);
+
+  release(&vblk.lock);
+}
+
+// Start syncing buf with disk, but do not wait for it.
+// If B_ASYNC is set, virtiointr releases buf when done;
+// otherwise the caller must wait with virtiowaitany.
+void
+virtiosubmit(struct buf *b)
+{
+  acquire(&vblk.lock);
+  virtioenqueue(b);
+  release(&vblk.lock);
+}
+
+// Wait until the I/O virtiosubmit started on at least one
+// of the n bufs in bp is done, and return its index.
+int
+virtiowaitany(struct buf **bp, int n)
+{
+  int i;
+
+  acquire(&vblk.lock);
+  for(;;){
+    for(i = 0; i < n; i++){
+      if((bp[i]->flags & (B_VALID|B_DIRTY)) == B_VALID){
+        release(&vblk.lock);
+        return i;
+      }
+    }
+    if(n == 1)
+      sleep(bp[0], &vblk.lock);
+    else {
+      vblk.anywait++;
+      sleep(&vblk.anywait, &vblk.lock);
+      vblk.anywait--;
+    }
+  }
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+virtiorw(struct buf *b)
+{
+  acquire(&vblk.lock);
+  virtioenqueue(b);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vblk.lock);
+  release(&vblk.lock);
+}
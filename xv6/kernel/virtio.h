@@ -0,0 +1,64 @@
+#ifndef _VIRTIO_H_
+#define _VIRTIO_H_
+// Virtio devices, legacy PCI interface (virtio 0.9.5)
+
+#define VIRTIO_VENDOR           0x1af4
+#define VIRTIO_DEV_BLK          0x1001  // transitional block device
+
+// I/O registers, from BAR 0
+#define VIRTIO_HOST_FEATURES    0x00    // 32 bits
+#define VIRTIO_GUEST_FEATURES   0x04    // 32 bits
+#define VIRTIO_QUEUE_PFN        0x08    // 32 bits: ring address >> 12
+#define VIRTIO_QUEUE_SIZE       0x0c    // 16 bits
+#define VIRTIO_QUEUE_SEL        0x0e    // 16 bits
+#define VIRTIO_QUEUE_NOTIFY     0x10    // 16 bits
+#define VIRTIO_STATUS           0x12    // 8 bits
+#define VIRTIO_ISR              0x13    // 8 bits, cleared by reading
+
+// Device status bits
+#define VIRTIO_ST_ACK           1
+#define VIRTIO_ST_DRIVER        2
+#define VIRTIO_ST_DRIVER_OK     4
+#define VIRTIO_ST_FAILED        0x80
+
+// Virtqueue descriptor
+struct vring_desc {
+  uint addr;            // physical address, low 32 bits
+  uint addrhi;          //   and high 32 bits
+  uint len;
+  ushort flags;
+  ushort next;          // next descriptor in chain, if VRING_DESC_NEXT
+};
+#define VRING_DESC_NEXT         1
+#define VRING_DESC_WRITE        2       // device writes (vs. reads) buffer
+
+// Ring of descriptor chains the driver has made available
+struct vring_avail {
+  ushort flags;
+  ushort idx;           // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;              // head of the finished descriptor chain
+  uint len;
+};
+
+// Ring of descriptor chains the device has finished with
+struct vring_used {
+  ushort flags;
+  ushort idx;           // where the device puts the next entry
+  struct vring_used_elem ring[];
+};
+
+// Block request header
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;          // low 32 bits
+  uint sectorhi;        //   and high 32 bits
+};
+#define VIRTIO_BLK_T_IN         0       // read
+#define VIRTIO_BLK_T_OUT        1       // write
+
+#endif // _VIRTIO_H_
@@ -19,9 +19,9 @@
 
 #define BLOCK_SIZE (512)
 
-int nblocks = 995;
+int nblocks;
 int ninodes = 200;
-int size = 1024;
+int size = 16384;  // 8 MB
 
 int fsfd;
 struct superblock sb;
@@ -31,6 +31,7 @@ uint usedblocks;
 uint bitblocks;
 uint freeinode = 1;
 uint root_inode;
+int extents;  // -e: map regular files by extents
 
 void balloc(int);
 void wsect(uint, void*);
@@ -39,6 +40,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint bmap(struct dinode *din, uint fbn);
+uint emap(struct dinode *din, uint fbn);
 
 // convert to intel byte order
 ushort
@@ -65,25 +68,28 @@ xint(uint x)
 
 
 int 
-mkfs(int nblocks, int ninodes, int size) {
+mkfs(int ninodes, int size) {
 
   int i;
   char buf[BLOCK_SIZE];
 
+  bitblocks = (size + BPB - 1) / BPB;
+  usedblocks = ninodes / IPB + 3 + bitblocks;
+  freeblock = usedblocks;
+  nblocks = size - usedblocks - NLOG;
+
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
+  sb.nlog = xint(NLOG);
+  sb.logstart = xint(size - NLOG);
 
-  bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
-  freeblock = usedblocks;
+  printf("used %d (bit %d ninode %zu) free %u log %zu total %d\n", usedblocks,
+         bitblocks, ninodes/IPB + 1, freeblock, NLOG, (int)(nblocks+usedblocks+NLOG));
 
-  printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
+  assert(nblocks + usedblocks + NLOG == size);
 
-  assert(nblocks + usedblocks == size);
-
-  for(i = 0; i < nblocks + usedblocks; i++)
+  for(i = 0; i < size; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -171,7 +177,7 @@ add_dir(DIR *cur_dir, int cur_inode, int parent_inode) {
 			}
 		} else {
 			bytes_read = 0;
-	  		child_inode = ialloc(T_FILE);
+	  		child_inode = ialloc(extents ? T_EXTENT : T_FILE);
 			bzero(&de, sizeof(de));
 			while((bytes_read = read(child_fd, buf, sizeof(buf))) > 0) {
 				iappend(child_inode, buf, bytes_read);
@@ -187,6 +193,8 @@ add_dir(DIR *cur_dir, int cur_inode, int parent_inode) {
 
 	// fix size of inode cur_dir
 	rinode(cur_inode, &din);
+	if (xshort(din.flags) & DI_INLINE)
+		return 0;
 	off = xint(din.size);
 	off = ((off/BSIZE) + 1) * BSIZE;
 	din.size = xint(off);
@@ -203,8 +211,13 @@ main(int argc, char *argv[])
   int r;
   DIR *root_dir;
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc > 1 && strcmp(argv[1], "-e") == 0){
+    extents = 1;
+    argc--;
+    argv++;
+  }
+  if(argc < 3){
+    fprintf(stderr, "Usage: mkfs [-e] fs.img dir\n");
     exit(1);
   }
 
@@ -217,7 +230,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  mkfs(995, 200, 1024);
+  mkfs(ninodes, size);
 
   root_dir = opendir(argv[2]);
 
@@ -229,6 +242,7 @@ main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
 
+  assert(usedblocks <= size - NLOG);
   balloc(usedblocks);
 
   exit(0);
@@ -301,6 +315,8 @@ ialloc(ushort type)
 
   bzero(&din, sizeof(din));
   din.type = xshort(type);
+  if(type == T_FILE || type == T_DIR)
+    din.flags = xshort(DI_INLINE);  // starts inline, as in the kernel
   din.nlink = xshort(1);
   din.size = xint(0);
   winode(inum, &din);
@@ -311,16 +327,19 @@ void
 balloc(int used)
 {
   uchar buf[512];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < 512*8);
-  bzero(buf, 512);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < size);
+  for(b = 0; b < bitblocks; b++){
+    bzero(buf, 512);
+    for(i = 0; i < BPB && b*BPB + i < size; i++){
+      if(b*BPB + i < used || b*BPB + i >= size - NLOG)  // in use, or the log
+        buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3 + b);
+    wsect(ninodes / IPB + 3 + b, buf);
   }
-  printf("balloc: write bitmap block at sector %zu\n", ninodes/IPB + 3);
-  wsect(ninodes / IPB + 3, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
@@ -332,35 +351,34 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[512];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
 
   off = xint(din.size);
+  if(xshort(din.flags) & DI_INLINE){
+    if(off + n <= SMALLFILE_SIZE){
+      bcopy(p, (char*)din.addrs + off, n);
+      din.size = xint(off + n);
+      winode(inum, &din);
+      return;
+    }
+    // Outgrown: move what is there to blocks, then append.
+    bcopy(din.addrs, buf, off);
+    bzero(din.addrs, sizeof(din.addrs));
+    din.flags = xshort(xshort(din.flags) & ~DI_INLINE);
+    din.size = xint(0);
+    winode(inum, &din);
+    iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
   while(n > 0){
     fbn = off / 512;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
+    if(xshort(din.type) == T_EXTENT){
+      x = emap(&din, fbn);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
-      }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
+      assert(fbn < MAXFILE);
+      x = bmap(&din, fbn);
     }
     n1 = min(n, (fbn + 1) * 512 - off);
     rsect(x, buf);
@@ -373,3 +391,100 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Allocate a block for *p if it has none; return the block.
+uint
+ablock(uint *p)
+{
+  if(xint(*p) == 0){
+    *p = xint(freeblock++);
+    usedblocks++;
+  }
+  return xint(*p);
+}
+
+// Return the block holding block fbn of inode din, allocating
+// it and any indirect blocks on the way if need be.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint addr, n, span;
+  int depth, i;
+
+  if(fbn < NDIRECT)
+    return ablock(&din->addrs[fbn]);
+  fbn -= NDIRECT;
+
+  for(depth = 1, n = NINDIRECT; fbn >= n; depth++, n *= NINDIRECT)
+    fbn -= n;
+  assert(depth <= 3);
+  addr = ablock(&din->addrs[NDIRECT+depth-1]);
+  for(span = n / NINDIRECT; ; span /= NINDIRECT){
+    rsect(addr, (char*)indirect);
+    i = fbn / span;
+    if(indirect[i] == 0){
+      ablock(&indirect[i]);
+      wsect(addr, (char*)indirect);
+    }
+    addr = xint(indirect[i]);
+    if(span == 1)
+      return addr;
+    fbn %= span;
+  }
+}
+
+// Return the block holding block fbn of extent-mapped inode din,
+// allocating it if fbn is just past the end of the file.
+// Blocks come from freeblock in order, so a file written in
+// one go ends up as a single run.
+uint
+emap(struct dinode *din, uint fbn)
+{
+  struct extent *e, *last, ind[NEXTENTIND];
+  uint i, x;
+  int inind;
+
+  e = (struct extent*)din->addrs;
+  last = 0;
+  inind = 0;
+  for(i = 0; i < NEXTENT && xint(e[i].len) > 0; i++){
+    if(fbn < xint(e[i].len))
+      return xint(e[i].start) + fbn;
+    fbn -= xint(e[i].len);
+    last = &e[i];
+  }
+  if(i == NEXTENT && xint(din->addrs[NADDRS-1]) != 0){
+    rsect(xint(din->addrs[NADDRS-1]), (char*)ind);
+    for(i = 0; i < NEXTENTIND && xint(ind[i].len) > 0; i++){
+      if(fbn < xint(ind[i].len))
+        return xint(ind[i].start) + fbn;
+      fbn -= xint(ind[i].len);
+      last = &ind[i];
+    }
+    e = ind;
+    inind = 1;
+  }
+  assert(fbn == 0);
+
+  x = freeblock++;
+  usedblocks++;
+  if(last && xint(last->start) + xint(last->len) == x){
+    last->len = xint(xint(last->len) + 1);
+  } else {
+    if(!inind && i == NEXTENT){
+      din->addrs[NADDRS-1] = xint(freeblock++);
+      usedblocks++;
+      bzero(ind, sizeof(ind));
+      e = ind;
+      inind = 1;
+      i = 0;
+    }
+    assert(i < (inind ? NEXTENTIND : NEXTENT));
+    e[i].start = xint(x);
+    e[i].len = xint(1);
+  }
+  if(inind)
+    wsect(xint(din->addrs[NADDRS-1]), (char*)ind);
+  return x;
+}
@@ -0,0 +1,98 @@
+// Buffer cache scaling benchmark.
+// Each child re-reads its own file, which is already cached, so
+// every read is a buffer cache hit on a block no other child uses.
+// Run under "make qemu CPUS=8" to see hit throughput as the number
+// of readers grows.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NBLOCK 32   // blocks per file
+#define NPASS  100  // times each child reads its file
+
+char buf[BSIZE];
+char name[] = "bcbench0";
+
+void
+makefile(int i)
+{
+  int fd, b;
+
+  name[7] = '0' + i;
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+    printf(1, "bcachebench: cannot create %s\n", name);
+    exit();
+  }
+  memset(buf, 'a' + i, sizeof(buf));
+  for(b = 0; b < NBLOCK; b++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "bcachebench: write %s failed\n", name);
+      exit();
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(int i, int npass)
+{
+  int fd, b, pass;
+
+  name[7] = '0' + i;
+  for(pass = 0; pass < npass; pass++){
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "bcachebench: cannot open %s\n", name);
+      exit();
+    }
+    for(b = 0; b < NBLOCK; b++){
+      if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(1, "bcachebench: read %s failed\n", name);
+        exit();
+      }
+    }
+    close(fd);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int maxproc, n, i, t0, t;
+
+  maxproc = 8;
+  if(argc > 1)
+    maxproc = atoi(argv[1]);
+  if(maxproc < 1 || maxproc > 8){
+    printf(1, "usage: bcachebench [nproc <= 8]\n");
+    exit();
+  }
+
+  for(i = 0; i < maxproc; i++){
+    makefile(i);
+    readfile(i, 1);  // warm the cache
+  }
+
+  for(n = 1; n <= maxproc; n *= 2){
+    t0 = uptime();
+    for(i = 0; i < n; i++){
+      if(fork() == 0){
+        readfile(i, NPASS);
+        exit();
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait();
+    t = uptime() - t0;
+    printf(1, "%d readers: %d cached block reads in %d ticks\n",
+           n, n * NPASS * NBLOCK, t);
+  }
+
+  for(i = 0; i < maxproc; i++){
+    name[7] = '0' + i;
+    unlink(name);
+  }
+  exit();
+}
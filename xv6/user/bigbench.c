@@ -0,0 +1,78 @@
+// Large file streaming benchmark.
+// Writes a file of several megabytes sequentially, reads it back,
+// then removes it, reporting the ticks each phase takes.  Runs once
+// with a block-mapped file, whose tail goes through double indirect
+// blocks, and once with an extent-mapped one.
+// Usage: bigbench [megabytes]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define DEFMB  4           // default file size in megabytes
+#define CHUNK  (16*BSIZE)  // bytes per read or write
+
+char buf[CHUNK];
+char name[] = "bigbench";
+
+void
+run(int mode, char *mname, int mb)
+{
+  int fd, i, n, t0, t1, t2, t3;
+
+  n = mb * 1024 * 1024 / CHUNK;
+  if((fd = open(name, O_CREATE|O_RDWR|mode)) < 0){
+    printf(1, "bigbench: cannot create %s\n", name);
+    exit();
+  }
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf(1, "bigbench: write failed at chunk %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  t1 = uptime();
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf(1, "bigbench: cannot open %s\n", name);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, CHUNK) != CHUNK || ((int*)buf)[0] != i){
+      printf(1, "bigbench: read failed at chunk %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  t2 = uptime();
+
+  unlink(name);
+  t3 = uptime();
+
+  printf(1, "%s: %d MB write %d ticks, read %d ticks, unlink %d ticks\n",
+         mname, mb, t1 - t0, t2 - t1, t3 - t2);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int mb;
+
+  mb = DEFMB;
+  if(argc > 1)
+    mb = atoi(argv[1]);
+  if(mb <= 0){
+    printf(2, "usage: bigbench [megabytes]\n");
+    exit();
+  }
+
+  memset(buf, 'b', sizeof(buf));
+  run(0, "blocks", mb);
+  run(O_EXTENT, "extents", mb);
+  exit();
+}
@@ -0,0 +1,110 @@
+// Print buffer cache, name cache and log activity.
+// usage: iostat [interval [count]]
+// With no arguments, prints the totals since boot.  Otherwise
+// prints the activity during each interval (in ticks), count
+// times or forever.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kstat.h"
+
+void
+printrow(char *name, struct biodevstat *now, struct biodevstat *then)
+{
+  uint lookups, hits;
+
+  lookups = now->lookups - then->lookups;
+  hits = now->hits - then->hits;
+  printf(1, "%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", name,
+         lookups, hits, now->misses - then->misses,
+         lookups ? 100 * hits / lookups : 0,
+         now->evictions - then->evictions,
+         now->sleepticks - then->sleepticks,
+         now->writebacks - then->writebacks);
+}
+
+void
+printstat(struct biostat *now, struct biostat *then)
+{
+  static char name[] = "dev0";
+  int dev;
+
+  printf(1, "dev\tlookups\thits\tmisses\thit%%\tevict\tsleep\twback\n");
+  for(dev = 0; dev < KSTAT_NDEV; dev++){
+    if(now->dev[dev].lookups == then->dev[dev].lookups &&
+       now->dev[dev].writebacks == then->dev[dev].writebacks)
+      continue;
+    name[3] = '0' + dev;
+    printrow(name, &now->dev[dev], &then->dev[dev]);
+  }
+  printrow("total", &now->total, &then->total);
+}
+
+void
+printdstat(struct dcachestat *now, struct dcachestat *then)
+{
+  uint lookups, hits;
+
+  lookups = now->lookups - then->lookups;
+  hits = (now->hits - then->hits) + (now->neghits - then->neghits);
+  printf(1, "dcache\tlookups\thits\tneg\tmisses\thit%%\tevict\tinval\n");
+  printf(1, "\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+         lookups, now->hits - then->hits, now->neghits - then->neghits,
+         now->misses - then->misses, lookups ? 100 * hits / lookups : 0,
+         now->evictions - then->evictions,
+         now->invalidations - then->invalidations);
+}
+
+void
+printlstat(struct logstat *now, struct logstat *then)
+{
+  uint ops, commits;
+
+  ops = now->ops - then->ops;
+  commits = now->commits - then->commits;
+  printf(1, "log\tops\tcommits\tops/c\tblocks\tabsorb\twaits\tmaxops\n");
+  printf(1, "\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+         ops, commits, commits ? ops / commits : 0,
+         now->blocks - then->blocks, now->absorbed - then->absorbed,
+         now->waits - then->waits, now->maxops);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct biostat st[2];
+  struct dcachestat dst[2];
+  struct logstat lst[2];
+  int interval, count, i;
+
+  interval = argc > 1 ? atoi(argv[1]) : 0;
+  count = argc > 2 ? atoi(argv[2]) : -1;
+
+  memset(&st[1], 0, sizeof(st[1]));
+  memset(&dst[1], 0, sizeof(dst[1]));
+  memset(&lst[1], 0, sizeof(lst[1]));
+  if(kstat(KSTAT_BIO, &st[0], sizeof(st[0])) < 0 ||
+     kstat(KSTAT_DCACHE, &dst[0], sizeof(dst[0])) < 0 ||
+     kstat(KSTAT_LOG, &lst[0], sizeof(lst[0])) < 0){
+    printf(2, "iostat: kstat failed\n");
+    exit();
+  }
+  if(interval <= 0){
+    printstat(&st[0], &st[1]);
+    printdstat(&dst[0], &dst[1]);
+    printlstat(&lst[0], &lst[1]);
+    exit();
+  }
+
+  for(i = 0; count < 0 || i < count; i++){
+    sleep(interval);
+    kstat(KSTAT_BIO, &st[(i+1)%2], sizeof(st[0]));
+    kstat(KSTAT_DCACHE, &dst[(i+1)%2], sizeof(dst[0]));
+    kstat(KSTAT_LOG, &lst[(i+1)%2], sizeof(lst[0]));
+    printstat(&st[(i+1)%2], &st[i%2]);
+    printdstat(&dst[(i+1)%2], &dst[i%2]);
+    printlstat(&lst[(i+1)%2], &lst[i%2]);
+  }
+  exit();
+}
@@ -18,7 +18,12 @@ USER_PROGS := \
 	wc\
 	zombie\
 	hello\
-	asd
+	asd\
+	bcachebench\
+	iostat\
+	scanbench\
+	bigbench\
+	smallbench
 
 USER_PROGS := $(addprefix user/, $(USER_PROGS))
 
@@ -0,0 +1,125 @@
+// Buffer cache scan resistance benchmark.
+// Shrinks the cache as far as it goes, then alternates between
+// reading a small hot set of files and streaming through a file
+// a few times larger than the cache, under LRU and then under
+// 2Q.  Reports the hit rate of the hot set reads that follow
+// each scan: LRU loses the hot set to every scan, 2Q should
+// keep it.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "kstat.h"
+
+#define NHOT     8    // hot files
+#define HOTBLK   2    // blocks per hot file
+#define BIGX     3    // streamed file size, in cache sizes
+#define NROUND   5    // scans per policy
+
+char buf[BSIZE];
+char hotname[] = "scanhot0";
+char bigname[] = "scanbig";
+
+void
+makefile(char *name, int nblock)
+{
+  int fd, b;
+
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+    printf(1, "scanbench: cannot create %s\n", name);
+    exit();
+  }
+  memset(buf, name[4], sizeof(buf));
+  for(b = 0; b < nblock; b++){
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "scanbench: write %s failed\n", name);
+      exit();
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(char *name)
+{
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) < 0){
+    printf(1, "scanbench: cannot open %s\n", name);
+    exit();
+  }
+  while(read(fd, buf, sizeof(buf)) == sizeof(buf))
+    ;
+  close(fd);
+}
+
+void
+readhot(void)
+{
+  int i;
+
+  for(i = 0; i < NHOT; i++){
+    hotname[7] = '0' + i;
+    readfile(hotname);
+  }
+}
+
+void
+run(int policy, char *pname)
+{
+  struct biostat st0, st1;
+  uint lookups, hits;
+  int round;
+
+  bcachectl(BCTL_POLICY, policy);
+
+  // Use the hot set at a few different ticks so 2Q sees it reused.
+  for(round = 0; round < 3; round++){
+    readhot();
+    sleep(1);
+  }
+
+  lookups = hits = 0;
+  for(round = 0; round < NROUND; round++){
+    readfile(bigname);
+    kstat(KSTAT_BIO, &st0, sizeof(st0));
+    readhot();
+    kstat(KSTAT_BIO, &st1, sizeof(st1));
+    lookups += st1.total.lookups - st0.total.lookups;
+    hits += st1.total.hits - st0.total.hits;
+    sleep(1);
+  }
+  printf(1, "%s: hot set after scan: %d lookups, %d hits (%d%%)\n",
+         pname, lookups, hits, lookups ? 100 * hits / lookups : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct bcachestat bs;
+  int i, n;
+
+  kstat(KSTAT_BCACHE, &bs, sizeof(bs));
+  n = bcachectl(BCTL_MAXBUF, bs.minbuf);
+  printf(1, "scanbench: cache shrunk from %d to %d buffers\n", bs.nbuf, n);
+
+  for(i = 0; i < NHOT; i++){
+    hotname[7] = '0' + i;
+    makefile(hotname, HOTBLK);
+  }
+  makefile(bigname, BIGX * n);
+
+  run(BPOLICY_LRU, "lru");
+  run(BPOLICY_2Q, "2q");
+
+  for(i = 0; i < NHOT; i++){
+    hotname[7] = '0' + i;
+    unlink(hotname);
+  }
+  unlink(bigname);
+  bcachectl(BCTL_POLICY, bs.policy);
+  bcachectl(BCTL_MAXBUF, bs.maxbuf);
+  exit();
+}
@@ -0,0 +1,132 @@
+// Small file benchmark.
+// Runs the same small-file workloads against a file kept inline in
+// its inode and against one whose bytes are in a data block, and
+// reports the ticks each takes: the asd test's open, write one
+// byte, close; rewriting the first SMALLFILE_SIZE bytes a byte at
+// a time; and open, read, close.  Then creates NFILES files of
+// each kind and reports the data blocks they take.
+// Usage: smallbench [iterations]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define DEFITER 500  // default rounds of each workload
+#define NFILES  20   // files created of each kind
+
+char buf[BSIZE];
+char name[] = "smallb00";
+
+// Make path hold n bytes: inline if n fits in the inode.
+void
+makefile(char *path, int n)
+{
+  int fd;
+
+  if((fd = open(path, O_CREATE|O_RDWR|O_TRUNC)) < 0){
+    printf(1, "smallbench: cannot create %s\n", path);
+    exit();
+  }
+  if(write(fd, buf, n) != n){
+    printf(1, "smallbench: write %s failed\n", path);
+    exit();
+  }
+  close(fd);
+}
+
+// Set name to the ith file's name.
+void
+setname(int i)
+{
+  name[6] = '0' + i/10;
+  name[7] = '0' + i%10;
+}
+
+void
+run(char *kind, int size, int niter)
+{
+  struct statfs st0, st1;
+  int fd, i, j, t0, t1, t2, t3;
+
+  setname(0);
+  makefile(name, size);
+
+  t0 = uptime();
+  for(i = 0; i < niter; i++){
+    if((fd = open(name, O_RDWR)) < 0 || write(fd, &buf[i%BSIZE], 1) != 1){
+      printf(1, "smallbench: %s: write failed\n", kind);
+      exit();
+    }
+    close(fd);
+  }
+  t1 = uptime();
+
+  for(i = 0; i < niter; i++){
+    if((fd = open(name, O_RDWR)) < 0){
+      printf(1, "smallbench: %s: open failed\n", kind);
+      exit();
+    }
+    for(j = 0; j < SMALLFILE_SIZE; j++){
+      if(write(fd, &buf[j], 1) != 1){
+        printf(1, "smallbench: %s: rewrite failed\n", kind);
+        exit();
+      }
+    }
+    close(fd);
+  }
+  t2 = uptime();
+
+  for(i = 0; i < niter; i++){
+    if((fd = open(name, O_RDONLY)) < 0 ||
+       read(fd, buf + SMALLFILE_SIZE, SMALLFILE_SIZE) != SMALLFILE_SIZE){
+      printf(1, "smallbench: %s: read failed\n", kind);
+      exit();
+    }
+    close(fd);
+  }
+  t3 = uptime();
+  unlink(name);
+
+  printf(1, "%s: write %d ticks, rewrite %d ticks, read %d ticks\n",
+         kind, t1 - t0, t2 - t1, t3 - t2);
+
+  // Create the files empty first, so that any block the
+  // directory grows by is not counted.
+  for(i = 0; i < NFILES; i++){
+    setname(i);
+    makefile(name, 0);
+  }
+  statfs("/", &st0);
+  for(i = 0; i < NFILES; i++){
+    setname(i);
+    makefile(name, size);
+  }
+  statfs("/", &st1);
+  for(i = 0; i < NFILES; i++){
+    setname(i);
+    unlink(name);
+  }
+  printf(1, "%s: %d files of %d bytes take %d blocks\n",
+         kind, NFILES, size, st0.bfree - st1.bfree);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int niter;
+
+  niter = DEFITER;
+  if(argc > 1)
+    niter = atoi(argv[1]);
+  if(niter <= 0){
+    printf(2, "usage: smallbench [iterations]\n");
+    exit();
+  }
+
+  memset(buf, 's', sizeof(buf));
+  run("inline", SMALLFILE_SIZE, niter);
+  run("blocks", SMALLFILE_SIZE + 1, niter);
+  exit();
+}
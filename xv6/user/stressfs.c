@@ -10,11 +10,28 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "kstat.h"
+
+// Print how the disk queue served the writes.
+static void
+printide(void)
+{
+  struct idestat st;
+
+  if(kstat(KSTAT_IDE, &st, sizeof(st)) < 0){
+    printf(1, "stressfs: kstat failed\n");
+    return;
+  }
+  printf(1, "ide: %d requests, %d commands, avg seek %d, max depth %d\n",
+         st.nreq, st.ncmd, st.ncmd ? st.seek / st.ncmd : 0, st.maxdepth);
+  printf(1, "ide: %d sweeps, %d cut for deadline, max wait %d ticks\n",
+         st.nsweep, st.nexpired, st.maxwait);
+}
 
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, n;
   char path[] = "stressfs0";
 
   printf(1, "stressfs starting\n");
@@ -25,13 +42,19 @@ main(int argc, char *argv[])
 
   printf(1, "%d\n", i);
 
-  path[8] += i;
+  n = i;
+  path[8] += n;
   fd = open(path, O_CREATE | O_RDWR);
   for(i = 0; i < 100; i++)
     printf(fd, "%d\n", i);
   close(fd);
 
   wait();
+
+  if(n == 0){
+    sync();
+    printide();
+  }
   
   exit();
 }
@@ -2,6 +2,7 @@
 #define _USER_H_
 
 struct stat;
+struct statfs;
 
 // system calls
 int fork(void);
@@ -25,6 +26,11 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int kstat(int, void*, int);
+int sync(void);
+int fsync(int);
+int bcachectl(int, int);
+int statfs(char*, struct statfs*);
 
 // user library functions (ulib.c)
 int stat(char*, struct stat*);
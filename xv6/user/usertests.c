@@ -5,6 +5,7 @@
 #include "fcntl.h"
 #include "syscall.h"
 #include "traps.h"
+#include "kstat.h"
 
 #define PAGE (4096)
 #define MAX_PROC_MEM (640 * 1024)
@@ -85,6 +86,299 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// statfs tracks blocks as files are written and removed
+void
+statfstest(void)
+{
+  struct statfs st0, st1, st2;
+  int fd;
+
+  printf(stdout, "statfs test\n");
+  if(statfs("/", &st0) < 0){
+    printf(stdout, "error: statfs failed\n");
+    exit();
+  }
+  if(st0.bsize != BSIZE || st0.bfree > st0.nblocks || st0.nblocks > st0.size){
+    printf(stdout, "error: statfs bsize %d size %d nblocks %d bfree %d\n",
+           st0.bsize, st0.size, st0.nblocks, st0.bfree);
+    exit();
+  }
+
+  fd = open("statfsf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(stdout, "error: write statfsf failed\n");
+    exit();
+  }
+  close(fd);
+  statfs("/", &st1);
+  if(st1.ifree != st0.ifree - 1){
+    printf(stdout, "error: statfs free inodes %d -> %d after create\n",
+           st0.ifree, st1.ifree);
+    exit();
+  }
+  if(st0.bfree - st1.bfree < sizeof(buf) / BSIZE){
+    printf(stdout, "error: statfs free %d -> %d after write\n",
+           st0.bfree, st1.bfree);
+    exit();
+  }
+
+  unlink("statfsf");
+  statfs("/", &st2);
+  if(st2.ifree != st0.ifree){
+    printf(stdout, "error: statfs free inodes %d -> %d after unlink\n",
+           st1.ifree, st2.ifree);
+    exit();
+  }
+  if(st2.bfree - st1.bfree != sizeof(buf) / BSIZE){
+    printf(stdout, "error: statfs free %d -> %d after unlink\n",
+           st1.bfree, st2.bfree);
+    exit();
+  }
+  if(statfs("nonexistent", &st2) != -1){
+    printf(stdout, "error: statfs of nonexistent file succeeded\n");
+    exit();
+  }
+
+  printf(stdout, "statfs test ok\n");
+}
+
+// concurrent creates and unlinks share log commits,
+// and sync leaves nothing uncommitted
+void
+logtest(void)
+{
+  struct logstat st0, st1;
+  char name[4];
+  int c, i, fd;
+
+  printf(stdout, "log test\n");
+  kstat(KSTAT_LOG, &st0, sizeof(st0));
+  name[0] = 'l';
+  name[3] = '\0';
+  for(c = 0; c < 4; c++){
+    if(fork() == 0){
+      name[1] = '0' + c;
+      for(i = 0; i < 10; i++){
+        name[2] = '0' + i;
+        if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+          printf(stdout, "error: create %s failed\n", name);
+          exit();
+        }
+        write(fd, name, sizeof(name));
+        close(fd);
+        unlink(name);
+      }
+      exit();
+    }
+  }
+  for(c = 0; c < 4; c++)
+    wait();
+  sync();
+  kstat(KSTAT_LOG, &st1, sizeof(st1));
+  if(st1.ops - st0.ops < 4*10*4){
+    printf(stdout, "error: %d log operations for 160 calls\n", st1.ops - st0.ops);
+    exit();
+  }
+  if(st1.commits - st0.commits >= st1.ops - st0.ops){
+    printf(stdout, "error: %d commits for %d operations\n",
+           st1.commits - st0.commits, st1.ops - st0.ops);
+    exit();
+  }
+  if(st1.pending != 0){
+    printf(stdout, "error: %d blocks uncommitted after sync\n", st1.pending);
+    exit();
+  }
+  printf(stdout, "log test ok\n");
+}
+
+// delayed writes read back the same before and after sync/fsync
+void
+synctest(void)
+{
+  int fd, i, fds[2];
+
+  printf(stdout, "sync test\n");
+  fd = open("syncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: creat syncf failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i;
+  if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(stdout, "error: write syncf failed\n");
+    exit();
+  }
+  if(fsync(fd) < 0){
+    printf(stdout, "error: fsync syncf failed\n");
+    exit();
+  }
+  close(fd);
+  if(sync() < 0){
+    printf(stdout, "error: sync failed\n");
+    exit();
+  }
+
+  fd = open("syncf", O_RDONLY);
+  memset(buf, 0, sizeof(buf));
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+    printf(stdout, "error: read syncf failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++){
+    if(buf[i] != (char)i){
+      printf(stdout, "error: syncf wrong content\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("syncf");
+
+  if(pipe(fds) < 0){
+    printf(stdout, "error: pipe failed\n");
+    exit();
+  }
+  if(fsync(fds[0]) != -1){
+    printf(stdout, "error: fsync on a pipe succeeded\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "sync test ok\n");
+}
+
+// the name cache answers repeated lookups and follows
+// creates and unlinks
+void
+dcachetest(void)
+{
+  struct dcachestat st0, st1;
+  int fd, i;
+
+  printf(stdout, "dcache test\n");
+  mkdir("dcd");
+  fd = open("dcd/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: create dcd/f failed\n");
+    exit();
+  }
+  close(fd);
+
+  kstat(KSTAT_DCACHE, &st0, sizeof(st0));
+  for(i = 0; i < 10; i++){
+    if((fd = open("dcd/f", O_RDONLY)) < 0){
+      printf(stdout, "error: open dcd/f failed\n");
+      exit();
+    }
+    close(fd);
+  }
+  kstat(KSTAT_DCACHE, &st1, sizeof(st1));
+  if(st1.hits - st0.hits < 2*10 - 2){
+    printf(stdout, "error: dcache hits %d -> %d for 10 opens\n",
+           st0.hits, st1.hits);
+    exit();
+  }
+
+  // A negative entry must not outlive the name's creation,
+  // and a positive one must not outlive its unlink.
+  if(open("dcd/g", O_RDONLY) >= 0){
+    printf(stdout, "error: opened nonexistent dcd/g\n");
+    exit();
+  }
+  if((fd = open("dcd/g", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "error: create dcd/g failed\n");
+    exit();
+  }
+  close(fd);
+  if((fd = open("dcd/g", O_RDONLY)) < 0){
+    printf(stdout, "error: dcd/g not found after create\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("dcd/g") < 0 || open("dcd/g", O_RDONLY) >= 0){
+    printf(stdout, "error: dcd/g still found after unlink\n");
+    exit();
+  }
+
+  // Names under a removed directory must not show up
+  // in a new directory that reuses its inode.
+  unlink("dcd/f");
+  if(unlink("dcd") < 0){
+    printf(stdout, "error: unlink dcd failed\n");
+    exit();
+  }
+  mkdir("dcd");
+  if(open("dcd/f", O_RDONLY) >= 0){
+    printf(stdout, "error: dcd/f found in new dcd\n");
+    exit();
+  }
+  unlink("dcd");
+  printf(stdout, "dcache test ok\n");
+}
+
+// a directory big enough to get a hash index still finds,
+// replaces and removes names
+void
+hashdirtest(void)
+{
+  char name[6];
+  int i, fd;
+
+  printf(stdout, "hashed directory test\n");
+  if(mkdir("hd") < 0 || (fd = open("hd/f", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "error: create hd/f failed\n");
+    exit();
+  }
+  close(fd);
+
+  name[0] = 'h';
+  name[1] = 'd';
+  name[2] = '/';
+  name[5] = '\0';
+  for(i = 0; i < 300; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if(link("hd/f", name) < 0){
+      printf(stdout, "error: link %s failed\n", name);
+      exit();
+    }
+  }
+  // Remove every other name, then look all of them up.
+  for(i = 0; i < 300; i += 2){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if(unlink(name) < 0){
+      printf(stdout, "error: unlink %s failed\n", name);
+      exit();
+    }
+  }
+  for(i = 0; i < 300; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    fd = open(name, O_RDONLY);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf(stdout, "error: open %s gave %d\n", name, fd);
+      exit();
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  for(i = 1; i < 300; i += 2){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    unlink(name);
+  }
+  unlink("hd/f");
+  if(unlink("hd") < 0){
+    printf(stdout, "error: unlink hd failed\n");
+    exit();
+  }
+  printf(stdout, "hashed directory test ok\n");
+}
+
+// Blocks in the big file: reaches into the double indirect blocks.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 2*NINDIRECT)
+
 void
 writetest1(void)
 {
@@ -98,7 +392,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -118,7 +412,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -1199,6 +1493,68 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// buffer cache size is readable and stays within its bounds
+void
+bcachesize(void)
+{
+  struct bcachestat st;
+
+  printf(1, "bcache size test\n");
+
+  if(kstat(KSTAT_BCACHE, &st, sizeof(st)) < 0){
+    printf(1, "kstat bcache failed\n");
+    exit();
+  }
+  if(st.nbuf < st.minbuf || st.nbuf > st.maxbuf){
+    printf(1, "bcache size %d outside [%d, %d]\n", st.nbuf, st.minbuf, st.maxbuf);
+    exit();
+  }
+  if(kstat(KSTAT_BCACHE, &st, sizeof(st) - 1) != -1){
+    printf(1, "kstat accepted a short buffer\n");
+    exit();
+  }
+
+  printf(1, "bcache size test OK\n");
+}
+
+// re-reading a cached file should count as lookups and hits
+void
+biostattest(void)
+{
+  struct biostat st0, st1;
+  int fd;
+
+  printf(1, "biostat test\n");
+
+  if((fd = open("echo", O_RDONLY)) < 0){
+    printf(1, "open echo failed\n");
+    exit();
+  }
+  read(fd, buf, 512);
+  close(fd);
+  if(kstat(KSTAT_BIO, &st0, sizeof(st0)) < 0){
+    printf(1, "kstat bio failed\n");
+    exit();
+  }
+  fd = open("echo", O_RDONLY);
+  read(fd, buf, 512);
+  close(fd);
+  kstat(KSTAT_BIO, &st1, sizeof(st1));
+
+  if(st1.total.lookups <= st0.total.lookups ||
+     st1.total.hits <= st0.total.hits){
+    printf(1, "biostat did not count cached read\n");
+    exit();
+  }
+  if(st1.total.hits + st1.total.misses > st1.total.lookups){
+    printf(1, "biostat hits %d + misses %d > lookups %d\n",
+           st1.total.hits, st1.total.misses, st1.total.lookups);
+    exit();
+  }
+
+  printf(1, "biostat test OK\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1479,6 +1835,173 @@ bigargtest(void)
   wait();
 }
 
+// extent-mapped files read back what was written and give their blocks back
+void
+extenttest(void)
+{
+  struct statfs st0, st1;
+  int fd, i, n;
+
+  printf(stdout, "extent test\n");
+  statfs("/", &st0);
+  n = NDIRECT + NINDIRECT + 20;
+
+  fd = open("extentf", O_CREATE|O_EXTENT|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: create extentf failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    memset(buf, i, BSIZE);
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(stdout, "error: write extentf block %d failed\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("extentf", O_RDONLY);
+  if(fd < 0){
+    printf(stdout, "error: open extentf failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(read(fd, buf, BSIZE) != BSIZE){
+      printf(stdout, "error: read extentf block %d failed\n", i);
+      exit();
+    }
+    if(((int*)buf)[0] != i || (uchar)buf[BSIZE-1] != (uchar)i){
+      printf(stdout, "error: extentf block %d has wrong contents\n", i);
+      exit();
+    }
+  }
+  if(read(fd, buf, BSIZE) != 0){
+    printf(stdout, "error: read past end of extentf\n");
+    exit();
+  }
+  close(fd);
+
+  unlink("extentf");
+  statfs("/", &st1);
+  if(st1.bfree != st0.bfree){
+    printf(stdout, "error: extentf leaked blocks, free %d -> %d\n",
+           st0.bfree, st1.bfree);
+    exit();
+  }
+  printf(stdout, "extent test ok\n");
+}
+
+// small files and directories live in the inode, move to a block
+// when they outgrow it, and go back to the inode when truncated
+void
+inlinetest(void)
+{
+  struct statfs st0, st1;
+  struct stat st;
+  int fd, i;
+
+  printf(stdout, "inline test\n");
+  fd = open("inlinef", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "error: create inlinef failed\n");
+    exit();
+  }
+  statfs("/", &st0);
+  for(i = 0; i < SMALLFILE_SIZE; i++)
+    buf[i] = 'a' + i%26;
+  if(write(fd, buf, SMALLFILE_SIZE) != SMALLFILE_SIZE){
+    printf(stdout, "error: write inlinef failed\n");
+    exit();
+  }
+  statfs("/", &st1);
+  if(st1.bfree != st0.bfree){
+    printf(stdout, "error: inline write took %d blocks\n", st0.bfree - st1.bfree);
+    exit();
+  }
+  for(; i < 2*SMALLFILE_SIZE; i++)
+    buf[i] = 'a' + i%26;
+  if(write(fd, buf + SMALLFILE_SIZE, SMALLFILE_SIZE) != SMALLFILE_SIZE){
+    printf(stdout, "error: write past inline size failed\n");
+    exit();
+  }
+  close(fd);
+  statfs("/", &st1);
+  if(st0.bfree - st1.bfree != 1){
+    printf(stdout, "error: promoted inlinef took %d blocks\n", st0.bfree - st1.bfree);
+    exit();
+  }
+
+  fd = open("inlinef", O_RDONLY);
+  memset(buf, 0, 2*SMALLFILE_SIZE);
+  if(read(fd, buf, sizeof(buf)) != 2*SMALLFILE_SIZE){
+    printf(stdout, "error: read inlinef failed\n");
+    exit();
+  }
+  for(i = 0; i < 2*SMALLFILE_SIZE; i++){
+    if(buf[i] != 'a' + i%26){
+      printf(stdout, "error: inlinef byte %d wrong after promotion\n", i);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("inlinef", O_RDWR|O_TRUNC);
+  if(fd < 0 || fstat(fd, &st) < 0 || st.size != 0){
+    printf(stdout, "error: truncate inlinef failed\n");
+    exit();
+  }
+  statfs("/", &st1);
+  if(st1.bfree != st0.bfree){
+    printf(stdout, "error: truncated inlinef kept %d blocks\n", st0.bfree - st1.bfree);
+    exit();
+  }
+  if(write(fd, "xyz", 3) != 3 || read(fd, buf, 1) != 0){
+    printf(stdout, "error: write after truncate failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("inlinef");
+
+  // "." and ".." and one more entry fit in the inode; a fourth does not.
+  if(mkdir("inlined") < 0){
+    printf(stdout, "error: mkdir inlined failed\n");
+    exit();
+  }
+  statfs("/", &st0);
+  if(mkdir("inlined/a") < 0){
+    printf(stdout, "error: mkdir inlined/a failed\n");
+    exit();
+  }
+  statfs("/", &st1);
+  if(st1.bfree != st0.bfree){
+    printf(stdout, "error: inline directories took %d blocks\n", st0.bfree - st1.bfree);
+    exit();
+  }
+  close(open("inlined/b", O_CREATE|O_RDWR));
+  fd = open("inlined", O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) < 0 || st.size != 4*sizeof(struct dirent)){
+    printf(stdout, "error: inlined did not grow\n");
+    exit();
+  }
+  close(fd);
+  if((fd = open("inlined/a/.", O_RDONLY)) < 0){
+    printf(stdout, "error: lookup in inlined failed\n");
+    exit();
+  }
+  close(fd);
+  if(unlink("inlined/a") < 0 || unlink("inlined/b") < 0 || unlink("inlined") < 0){
+    printf(stdout, "error: unlink inlined failed\n");
+    exit();
+  }
+  statfs("/", &st1);
+  if(st1.bfree != st0.bfree){
+    printf(stdout, "error: inlined leaked %d blocks\n", st0.bfree - st1.bfree);
+    exit();
+  }
+  printf(stdout, "inline test ok\n");
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1494,9 +2017,18 @@ main(int argc, char *argv[])
   bsstest();
   sbrktest();
   validatetest();
+  bcachesize();
+  biostattest();
 
   opentest();
   writetest();
+  synctest();
+  logtest();
+  statfstest();
+  extenttest();
+  inlinetest();
+  dcachetest();
+  hashdirtest();
   writetest1();
   createtest();
 